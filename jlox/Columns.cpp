@@ -0,0 +1,491 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <thread>
+#include "Columns.h"
+
+uint32_t add_constant(T_KernelPlan& Plan, ValueKinds Kind, double Value)
+{
+   uint32_t index = Plan.Constants.size() / KERNEL_BLOCK_SIZE;
+
+   Plan.Constants.resize(Plan.Constants.size() + KERNEL_BLOCK_SIZE, Value);
+   Plan.Registers.push_back({ RegisterTypes::Constant, Kind, index });
+
+   return Plan.Registers.size() - 1;
+}
+
+uint32_t add_op(T_KernelPlan& Plan, ValueKinds Kind, KernelOps Op, uint32_t Left, uint32_t Right)
+{
+   Plan.Registers.push_back({ RegisterTypes::Temp, Kind, Plan.TempCount++ });
+   Plan.Ops.push_back({ Op, (uint32_t)Plan.Registers.size() - 1, Left, Right });
+
+   return Plan.Registers.size() - 1;
+}
+
+uint32_t compile_binary(T_KernelPlan& Plan, const T_BinaryExpr* Binary, uint32_t Left, uint32_t Right)
+{
+   switch (Binary->Operator.Type)
+   {
+      case EQUAL_EQUAL:
+      case BANG_EQUAL:
+      {
+         bool equal = Binary->Operator.Type == EQUAL_EQUAL;
+
+         // values of different kinds are never equal
+         if (Plan.Registers[Left].Kind != Plan.Registers[Right].Kind)
+            return add_constant(Plan, ValueKinds::Bool, equal ? 0.0 : 1.0);
+
+         return add_op(Plan, ValueKinds::Bool, equal ? KernelOps::Equal : KernelOps::NotEqual, Left, Right);
+      }
+      case GREATER:
+      case GREATER_EQUAL:
+      case LESS:
+      case LESS_EQUAL:
+      {
+         KernelOps op = KernelOps::Greater;
+
+         if (Binary->Operator.Type == GREATER_EQUAL) op = KernelOps::GreaterEqual;
+         else if (Binary->Operator.Type == LESS) op = KernelOps::Less;
+         else if (Binary->Operator.Type == LESS_EQUAL) op = KernelOps::LessEqual;
+
+         return add_op(Plan, ValueKinds::Bool, op, Left, Right);
+      }
+      default:
+      {
+         KernelOps op = KernelOps::Add;
+
+         if (Binary->Operator.Type == MINUS) op = KernelOps::Subtract;
+         else if (Binary->Operator.Type == STAR) op = KernelOps::Multiply;
+         else if (Binary->Operator.Type == SLASH) op = KernelOps::Divide;
+
+         return add_op(Plan, ValueKinds::Number, op, Left, Right);
+      }
+   }
+}
+
+uint32_t compile_kernel_node(T_LoxContext& Context, T_KernelPlan& Plan, const T_ColumnTable& Table, T_Expr Expr)
+{
+   if (!Expr.Expr)
+   {
+      report_error(Context, "Expect expression.", 1);
+      return add_constant(Plan, ValueKinds::Number, 0.0);
+   }
+
+   switch (Expr.Type)
+   {
+      case ExprTypes::Literal:
+      {
+         T_LiteralExpr* literal = (T_LiteralExpr*)Expr.Expr;
+
+         // numbers were parsed by type inference
+         if (literal->Value.Type == NUMBER)
+            return add_constant(Plan, ValueKinds::Number, literal->Number);
+
+         if (literal->Value.Type == TRUE || literal->Value.Type == FALSE)
+            return add_constant(Plan, ValueKinds::Bool, literal->Value.Type == TRUE ? 1.0 : 0.0);
+
+         report_error(Context, "Column kernels only support number and boolean literals.", literal->Value.Line);
+         return add_constant(Plan, ValueKinds::Number, 0.0);
+      }
+      case ExprTypes::Variable:
+      {
+         T_VariableExpr* variable = (T_VariableExpr*)Expr.Expr;
+
+         for (uint32_t i = 0; i < Table.Names.size(); i++)
+         {
+            if (Table.Names[i].size() == variable->Name.Length &&
+                memcmp(Table.Names[i].data(), variable->Name.Lexeme, variable->Name.Length) == 0)
+            {
+               Plan.Registers.push_back({ RegisterTypes::Column, ValueKinds::Number, i });
+               return Plan.Registers.size() - 1;
+            }
+         }
+
+         report_error(Context, "Undefined column.", variable->Name.Line);
+         return add_constant(Plan, ValueKinds::Number, 0.0);
+      }
+      case ExprTypes::Grouping:
+      {
+         T_GroupingExpr* grouping = (T_GroupingExpr*)Expr.Expr;
+         return compile_kernel(Context, Plan, Table, grouping->Expression);
+      }
+      case ExprTypes::Unary:
+      {
+         T_UnaryExpr* unary = (T_UnaryExpr*)Expr.Expr;
+         uint32_t     right = compile_kernel(Context, Plan, Table, unary->Right);
+         ValueKinds   kind  = Plan.Registers[right].Kind;
+
+         if (unary->Operator.Type == MINUS)
+            return add_op(Plan, ValueKinds::Number, KernelOps::Negate, right, right);
+
+         // numbers are always truthy
+         if (kind == ValueKinds::Number)
+            return add_constant(Plan, ValueKinds::Bool, 0.0);
+
+         return add_op(Plan, ValueKinds::Bool, KernelOps::Not, right, right);
+      }
+      case ExprTypes::Binary:
+      {
+         // long chains lean left, so their spine is compiled in a loop down
+         // to the first operand or to a subtree that is already compiled
+         std::vector<const T_BinaryExpr*>& spine = Context.Spine;
+         uint32_t                          base  = spine.size();
+         T_Expr                            first = Expr;
+
+         while (first.Type == ExprTypes::Binary && first.Expr &&
+                (spine.size() == base || !Plan.Compiled.count(first.Expr)))
+         {
+            spine.push_back((const T_BinaryExpr*)first.Expr);
+            first = spine.back()->Left;
+         }
+
+         uint32_t result = compile_kernel(Context, Plan, Table, first);
+
+         for (uint32_t i = spine.size(); i-- > base; )
+         {
+            uint32_t right = compile_kernel(Context, Plan, Table, spine[i]->Right);
+
+            result = compile_binary(Plan, spine[i], result, right);
+
+            // the top of the spine is recorded by compile_kernel
+            if (i > base)
+               Plan.Compiled[(void*)spine[i]] = result;
+         }
+
+         spine.resize(base);
+         return result;
+      }
+      case ExprTypes::Error:
+         // already reported by the parser
+         return add_constant(Plan, ValueKinds::Number, 0.0);
+   }
+
+   return add_constant(Plan, ValueKinds::Number, 0.0);
+}
+
+uint32_t compile_kernel(T_LoxContext& Context, T_KernelPlan& Plan, const T_ColumnTable& Table, T_Expr Expr)
+{
+   auto compiled = Plan.Compiled.find(Expr.Expr);
+
+   if (compiled != Plan.Compiled.end())
+      return compiled->second;
+
+   uint32_t result = compile_kernel_node(Context, Plan, Table, Expr);
+
+   if (Expr.Expr)
+      Plan.Compiled[Expr.Expr] = result;
+
+   return result;
+}
+
+// -O2 leaves these loops scalar under its very cheap cost model, so the
+// Makefile builds this file with the vectorizer's dynamic cost model
+void run_kernel_op(const T_KernelOp& Op, double* __restrict Dest, const double* __restrict Left, const double* __restrict Right, uint32_t Count)
+{
+   switch (Op.Op)
+   {
+      case KernelOps::Add:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = Left[i] + Right[i];
+         break;
+      case KernelOps::Subtract:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = Left[i] - Right[i];
+         break;
+      case KernelOps::Multiply:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = Left[i] * Right[i];
+         break;
+      case KernelOps::Divide:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = Left[i] / Right[i];
+         break;
+      case KernelOps::Greater:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = Left[i] > Right[i] ? 1.0 : 0.0;
+         break;
+      case KernelOps::GreaterEqual:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = Left[i] >= Right[i] ? 1.0 : 0.0;
+         break;
+      case KernelOps::Less:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = Left[i] < Right[i] ? 1.0 : 0.0;
+         break;
+      case KernelOps::LessEqual:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = Left[i] <= Right[i] ? 1.0 : 0.0;
+         break;
+      case KernelOps::Equal:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = Left[i] == Right[i] ? 1.0 : 0.0;
+         break;
+      case KernelOps::NotEqual:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = Left[i] != Right[i] ? 1.0 : 0.0;
+         break;
+      case KernelOps::Negate:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = -Left[i];
+         break;
+      case KernelOps::Not:
+         for (uint32_t i = 0; i < Count; i++) Dest[i] = 1.0 - Left[i];
+         break;
+   }
+}
+
+void run_kernel_range(const T_KernelPlan& Plan, const T_ColumnTable& Table, double* Output, uint32_t Start, uint32_t End)
+{
+   std::vector<double>        scratch(Plan.TempCount * KERNEL_BLOCK_SIZE);
+   std::vector<const double*> registers(Plan.Registers.size());
+
+   for (uint32_t block = Start; block < End; block += KERNEL_BLOCK_SIZE)
+   {
+      uint32_t count = End - block < KERNEL_BLOCK_SIZE ? End - block : KERNEL_BLOCK_SIZE;
+
+      for (uint32_t i = 0; i < Plan.Registers.size(); i++)
+      {
+         const T_KernelRegister& reg = Plan.Registers[i];
+
+         switch (reg.Type)
+         {
+            case RegisterTypes::Column:
+               registers[i] = Table.Columns[reg.Index].data() + block;
+               break;
+            case RegisterTypes::Constant:
+               registers[i] = &Plan.Constants[reg.Index * KERNEL_BLOCK_SIZE];
+               break;
+            case RegisterTypes::Temp:
+               registers[i] = &scratch[reg.Index * KERNEL_BLOCK_SIZE];
+               break;
+         }
+      }
+
+      // the last op writes straight into the output column
+      if (Plan.Registers[Plan.Result].Type == RegisterTypes::Temp)
+         registers[Plan.Result] = Output + block;
+
+      for (const auto& op : Plan.Ops)
+      {
+         run_kernel_op(op, (double*)registers[op.Dest], registers[op.Left], registers[op.Right], count);
+      }
+
+      if (Plan.Registers[Plan.Result].Type != RegisterTypes::Temp)
+         memcpy(Output + block, registers[Plan.Result], count * sizeof(double));
+   }
+}
+
+void run_kernel(const T_KernelPlan& Plan, const T_ColumnTable& Table, double* Output, uint32_t& ThreadCount)
+{
+   uint32_t blocks = (Table.Rows + KERNEL_BLOCK_SIZE - 1) / KERNEL_BLOCK_SIZE;
+
+   ThreadCount = std::thread::hardware_concurrency();
+
+   if (ThreadCount == 0) ThreadCount = 1;
+   if (ThreadCount > blocks) ThreadCount = blocks ? blocks : 1;
+
+   uint32_t blocks_per_thread = (blocks + ThreadCount - 1) / ThreadCount;
+   std::vector<std::thread> threads;
+
+   for (uint32_t i = 0; i < ThreadCount; i++)
+   {
+      uint32_t start = i * blocks_per_thread * KERNEL_BLOCK_SIZE;
+      uint32_t end   = start + blocks_per_thread * KERNEL_BLOCK_SIZE;
+
+      if (start > Table.Rows) start = Table.Rows;
+      if (end > Table.Rows) end = Table.Rows;
+
+      threads.emplace_back(run_kernel_range, std::cref(Plan), std::cref(Table), Output, start, end);
+   }
+
+   for (auto& thread : threads)
+      thread.join();
+}
+
+bool load_csv(const char* Data, uint32_t Size, T_ColumnTable& Table)
+{
+   const char* current = Data;
+   const char* end     = Data + Size;
+
+   // header line holds the column names
+   while (current < end && *current != '\n')
+   {
+      const char* start = current;
+
+      while (current < end && *current != ',' && *current != '\n')
+         current++;
+
+      const char* last = current;
+
+      while (start < last && isspace(*start)) start++;
+      while (last > start && isspace(last[-1])) last--;
+
+      Table.Names.push_back(std::string(start, last - start));
+
+      if (current < end && *current == ',')
+         current++;
+   }
+
+   if (Table.Names.empty())
+   {
+      fprintf(stderr, "ERROR: Missing column names in header.\n");
+      return false;
+   }
+
+   Table.Columns.resize(Table.Names.size());
+   Table.Rows = 0;
+
+   while (current < end)
+   {
+      // skip blank lines
+      while (current < end && isspace(*current))
+         current++;
+
+      if (current >= end)
+         break;
+
+      for (uint32_t i = 0; i < Table.Columns.size(); i++)
+      {
+         while (current < end && (*current == ' ' || *current == '\t'))
+            current++;
+
+         // strtod would skip a line break and take the next row's value
+         if (current >= end || *current == ',' || *current == '\n' || *current == '\r')
+         {
+            fprintf(stderr, "ERROR: Missing value in column \"%s\" at row %u.\n", Table.Names[i].c_str(), Table.Rows + 1);
+            return false;
+         }
+
+         char*  next;
+         double value = strtod(current, &next);
+
+         if (next == current)
+         {
+            fprintf(stderr, "ERROR: Invalid number in column \"%s\" at row %u.\n", Table.Names[i].c_str(), Table.Rows + 1);
+            return false;
+         }
+
+         Table.Columns[i].push_back(value);
+         current = next;
+
+         while (current < end && (*current == ' ' || *current == '\t' || *current == '\r'))
+            current++;
+
+         if (i + 1 < Table.Columns.size())
+         {
+            if (current >= end || *current != ',')
+            {
+               fprintf(stderr, "ERROR: Missing column \"%s\" at row %u.\n", Table.Names[i + 1].c_str(), Table.Rows + 1);
+               return false;
+            }
+
+            current++;
+         }
+      }
+
+      if (current < end && *current != '\n')
+      {
+         fprintf(stderr, "ERROR: Unexpected data after the last column at row %u.\n", Table.Rows + 1);
+         return false;
+      }
+
+      Table.Rows++;
+   }
+
+   return true;
+}
+
+bool load_binary(const uint8_t* Data, uint32_t Size, T_ColumnTable& Table)
+{
+   uint32_t columns;
+   uint32_t offset = 12;
+
+   if (Size < offset)
+      return false;
+
+   memcpy(&columns, Data + 4, sizeof(uint32_t));
+   memcpy(&Table.Rows, Data + 8, sizeof(uint32_t));
+
+   for (uint32_t i = 0; i < columns; i++)
+   {
+      uint32_t length;
+
+      if (offset + (uint64_t)sizeof(uint32_t) > Size)
+         return false;
+
+      memcpy(&length, Data + offset, sizeof(uint32_t));
+      offset += sizeof(uint32_t);
+
+      if (offset + (uint64_t)length > Size)
+         return false;
+
+      Table.Names.push_back(std::string((const char*)Data + offset, length));
+      offset += length;
+   }
+
+   if (offset + (uint64_t)columns * Table.Rows * sizeof(double) > Size)
+      return false;
+
+   Table.Columns.resize(columns);
+
+   for (uint32_t i = 0; i < columns; i++)
+   {
+      Table.Columns[i].resize(Table.Rows);
+      memcpy(Table.Columns[i].data(), Data + offset, Table.Rows * sizeof(double));
+      offset += Table.Rows * sizeof(double);
+   }
+
+   return true;
+}
+
+int format_number(char* Buffer, uint32_t Size, double Value)
+{
+   return snprintf(Buffer, Size, "%.15g", Value);
+}
+
+void write_column(const char* Filename, ValueKinds Kind, const std::vector<double>& Values)
+{
+   FILE* file   = Filename ? fopen(Filename, "wb") : stdout;
+   uint32_t len = Filename ? strlen(Filename) : 0;
+
+   if (!file)
+   {
+      fprintf(stderr, "ERROR: Unable to open \"%s\".\n", Filename);
+      return;
+   }
+
+   if (len > 4 && strcmp(Filename + len - 4, ".bin") == 0)
+   {
+      uint32_t header[4] = { 0, 1, (uint32_t)Values.size(), 6 };
+
+      memcpy(header, "JLXC", 4);
+      fwrite(header, sizeof(header), 1, file);
+      fwrite("result", 6, 1, file);
+      fwrite(Values.data(), sizeof(double), Values.size(), file);
+   }
+   else
+   {
+      char     buffer[65536];
+      uint32_t used = snprintf(buffer, sizeof(buffer), "result\n");
+
+      for (double value : Values)
+      {
+         if (used > sizeof(buffer) - 64)
+         {
+            fwrite(buffer, used, 1, file);
+            used = 0;
+         }
+
+         if (Kind == ValueKinds::Bool)
+            used += snprintf(buffer + used, sizeof(buffer) - used, "%s\n", value != 0.0 ? "true" : "false");
+         else
+         {
+            used += format_number(buffer + used, sizeof(buffer) - used, value);
+            buffer[used++] = '\n';
+         }
+      }
+
+      fwrite(buffer, used, 1, file);
+   }
+
+   if (file != stdout)
+      fclose(file);
+}
+
+bool load_columns(const uint8_t* Data, uint32_t Size, T_ColumnTable& Table)
+{
+   if (Size >= 4 && memcmp(Data, "JLXC", 4) == 0)
+      return load_binary(Data, Size, Table);
+
+   return load_csv((const char*)Data, Size, Table);
+}
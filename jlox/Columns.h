@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Lox.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Column batch evaluation
+//
+// jlox --columns evaluates one expression over every row of a table whose
+// columns are the expression's variables. The expression is compiled once
+// into a flat kernel plan where every op reads and writes a whole block of
+// rows. The per-op loops are simple enough for the compiler to vectorize,
+// and row ranges are split across threads.
+//
+// Columns hold numbers, so the parser's type inference, which has already
+// reported every operation proven to fail, leaves nothing for the compiler
+// to check but the column names and the literals a kernel can hold.
+//
+// Tables are CSV with a header line of names, or binary column files:
+// "JLXC", uint32 column count, uint32 row count, then each name as a uint32
+// length and its bytes, then the columns of doubles.
+
+static constexpr uint32_t KERNEL_BLOCK_SIZE = 1024;
+
+struct T_ColumnTable
+{
+   std::vector<std::string>         Names;
+   std::vector<std::vector<double>> Columns;
+   uint32_t                         Rows;
+};
+
+enum class KernelOps
+{
+   Add,
+   Subtract,
+   Multiply,
+   Divide,
+   Greater,
+   GreaterEqual,
+   Less,
+   LessEqual,
+   Equal,
+   NotEqual,
+   Negate,
+   Not,
+};
+
+enum class RegisterTypes
+{
+   Column,
+   Constant,
+   Temp,
+};
+
+enum class ValueKinds
+{
+   Number,
+   Bool,
+};
+
+struct T_KernelRegister
+{
+   RegisterTypes Type;
+   ValueKinds    Kind;
+   uint32_t      Index; // column index, constant block or temp slot
+};
+
+struct T_KernelOp
+{
+   KernelOps Op;
+   uint32_t  Dest;
+   uint32_t  Left;
+   uint32_t  Right; // unused by unary ops
+};
+
+struct T_KernelPlan
+{
+   std::vector<T_KernelRegister>       Registers;
+   std::vector<T_KernelOp>             Ops;
+   std::vector<double>                 Constants; // one broadcast block per constant
+   std::unordered_map<void*, uint32_t> Compiled;  // shared subtrees compile once
+   uint32_t                            TempCount;
+   uint32_t                            Result;
+};
+
+bool     load_columns(const uint8_t* Data, uint32_t Size, T_ColumnTable& Table);
+uint32_t compile_kernel(T_LoxContext& Context, T_KernelPlan& Plan, const T_ColumnTable& Table, T_Expr Expr);
+void     run_kernel(const T_KernelPlan& Plan, const T_ColumnTable& Table, double* Output, uint32_t& ThreadCount);
+void     write_column(const char* Filename, ValueKinds Kind, const std::vector<double>& Values);
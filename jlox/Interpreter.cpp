@@ -0,0 +1,870 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <charconv>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "Interpreter.h"
+
+static T_Value make_number(double Number)
+{
+   T_Value value;
+
+   value.Type   = ValueTypes::Number;
+   value.Number = Number;
+
+   return value;
+}
+
+static T_Value make_bool(bool Bool)
+{
+   T_Value value;
+
+   value.Type = ValueTypes::Bool;
+   value.Bool = Bool;
+
+   return value;
+}
+
+static T_Value make_nil()
+{
+   T_Value value;
+
+   value.Type   = ValueTypes::Nil;
+   value.Number = 0.0;
+
+   return value;
+}
+
+static T_Value runtime_error(T_LoxContext& Context, const char* Message, const T_Token& Token)
+{
+   T_Value value;
+
+   report_error(Context, Message, Token.Line);
+   value.Type   = ValueTypes::Unknown;
+   value.Number = 0.0;
+
+   return value;
+}
+
+static bool is_truthy(const T_Value& Value)
+{
+   if (Value.Type == ValueTypes::Nil)
+      return false;
+
+   if (Value.Type == ValueTypes::Bool)
+      return Value.Bool;
+
+   return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Strings
+
+uint32_t string_length(const T_String& String)
+{
+   switch (String.Kind)
+   {
+      case STRING_INLINE: return String.InlineLength;
+      case STRING_SLICE:  return String.Slice.Length;
+      default:            return String.Rope->Length;
+   }
+}
+
+// Writes the first Size bytes of String to Dest. A long chain of '+' makes a
+// very deep left spine, so that is walked in a loop; only right children
+// recurse, and the parser bounds how deep they nest. Flat strings go
+// straight to the copy.
+static void copy_string(const T_String& String, char* Dest, uint32_t Size)
+{
+   const T_String* string = &String;
+
+   while (string->Kind == STRING_ROPE && !string->Rope->Flat)
+   {
+      const T_RopeNode* rope = string->Rope;
+      uint32_t          left = string_length(rope->Left);
+
+      if (Size > left)
+      {
+         copy_string(rope->Right, Dest + left, Size - left);
+         Size = left;
+      }
+
+      string = &rope->Left;
+   }
+
+   const char* chars;
+   uint32_t    length;
+
+   switch (string->Kind)
+   {
+      case STRING_INLINE:
+         chars  = string->Inline;
+         length = string->InlineLength;
+         break;
+      case STRING_SLICE:
+         chars  = string->Slice.Chars;
+         length = string->Slice.Length;
+         break;
+      default:
+         chars  = string->Rope->Flat;
+         length = string->Rope->Length;
+         break;
+   }
+
+   memcpy(Dest, chars, length < Size ? length : Size);
+}
+
+const char* string_chars(T_LoxContext& Context, const T_String& String)
+{
+   switch (String.Kind)
+   {
+      case STRING_INLINE: return String.Inline;
+      case STRING_SLICE:  return String.Slice.Chars;
+      default:            break;
+   }
+
+   if (!String.Rope->Flat)
+   {
+      char* flat = (char*)Context.Nodes.Allocate(String.Rope->Length);
+
+      copy_string(String, flat, String.Rope->Length);
+      String.Rope->Flat = flat;
+   }
+
+   return String.Rope->Flat;
+}
+
+static T_Value make_string(const T_String& String)
+{
+   T_Value value;
+
+   value.Type   = ValueTypes::String;
+   value.String = String;
+
+   return value;
+}
+
+static T_Value concatenate(T_LoxContext& Context, const T_String& Left, const T_String& Right)
+{
+   uint32_t left   = string_length(Left);
+   uint32_t right  = string_length(Right);
+   T_String result = {};
+
+   if (left + right <= T_String::INLINE_CAPACITY)
+   {
+      result.Kind         = STRING_INLINE;
+      result.InlineLength = left + right;
+      copy_string(Left, result.Inline, left);
+      copy_string(Right, result.Inline + left, right);
+   }
+   else
+   {
+      T_RopeNode* rope = Context.Nodes.New<T_RopeNode>();
+
+      rope->Left   = Left;
+      rope->Right  = Right;
+      rope->Length = left + right;
+      rope->Flat   = nullptr;
+
+      result.Kind = STRING_ROPE;
+      result.Rope = rope;
+   }
+
+   return make_string(result);
+}
+
+// Strings
+///////////////////////////////////////////////////////////////////////////////
+
+static bool is_equal(T_LoxContext& Context, const T_Value& A, const T_Value& B)
+{
+   if (A.Type != B.Type)
+      return false;
+
+   switch (A.Type)
+   {
+      case ValueTypes::Nil:    return true;
+      case ValueTypes::Bool:   return A.Bool == B.Bool;
+      case ValueTypes::Number: return A.Number == B.Number;
+      case ValueTypes::String:
+      {
+         uint32_t length = string_length(A.String);
+
+         return length == string_length(B.String) &&
+                memcmp(string_chars(Context, A.String), string_chars(Context, B.String), length) == 0;
+      }
+      default:                 return false;
+   }
+}
+
+static T_Value evaluate_literal(const T_LiteralExpr* Literal)
+{
+   switch (Literal->Value.Type)
+   {
+      case NUMBER: return make_number(Literal->Number);
+      case TRUE:   return make_bool(true);
+      case FALSE:  return make_bool(false);
+      case STRING:
+      {
+         T_String string = {};
+
+         // no copy: the literal points at its lexeme
+         string.Kind         = STRING_SLICE;
+         string.Slice.Chars  = Literal->Value.Lexeme;
+         string.Slice.Length = Literal->Value.Length;
+
+         return make_string(string);
+      }
+      default:     return make_nil();
+   }
+}
+
+template <bool Profiled>
+static T_Value evaluate_node(T_LoxContext& Context, T_Expr Expr);
+static const T_Value* find_shared(T_LoxContext& Context, const void* Node);
+static void           keep_shared(T_LoxContext& Context, const void* Node, T_Value Value);
+static void           enter_child(T_Profile& Profile, T_Expr Expr);
+static void           leave_node(T_Profile& Profile);
+
+template <bool Profiled>
+static T_Value evaluate_unary(T_LoxContext& Context, const T_UnaryExpr* Unary)
+{
+   T_Value right = evaluate_node<Profiled>(Context, Unary->Right);
+
+   switch (Unary->Op)
+   {
+      case OpKinds::NegateNumber: return make_number(-right.Number);
+      case OpKinds::NotBool:      return make_bool(!right.Bool);
+      default:                    break;
+   }
+
+   if (right.Type == ValueTypes::Unknown)
+      return right;
+
+   if (Unary->Operator.Type == BANG)
+      return make_bool(!is_truthy(right));
+
+   if (right.Type != ValueTypes::Number)
+      return runtime_error(Context, "Operand must be a number.", Unary->Operator);
+
+   return make_number(-right.Number);
+}
+
+static T_Value apply_binary(T_LoxContext& Context, const T_BinaryExpr* Binary, T_Value Left, T_Value Right)
+{
+   // proven number-only: no checks
+   switch (Binary->Op)
+   {
+      case OpKinds::AddNumber:          return make_number(Left.Number + Right.Number);
+      case OpKinds::SubtractNumber:     return make_number(Left.Number - Right.Number);
+      case OpKinds::MultiplyNumber:     return make_number(Left.Number * Right.Number);
+      case OpKinds::DivideNumber:       return make_number(Left.Number / Right.Number);
+      case OpKinds::GreaterNumber:      return make_bool(Left.Number > Right.Number);
+      case OpKinds::GreaterEqualNumber: return make_bool(Left.Number >= Right.Number);
+      case OpKinds::LessNumber:         return make_bool(Left.Number < Right.Number);
+      case OpKinds::LessEqualNumber:    return make_bool(Left.Number <= Right.Number);
+      case OpKinds::EqualNumber:        return make_bool(Left.Number == Right.Number);
+      case OpKinds::NotEqualNumber:     return make_bool(Left.Number != Right.Number);
+      default:                          break;
+   }
+
+   if (Left.Type == ValueTypes::Unknown)
+      return Left;
+
+   if (Right.Type == ValueTypes::Unknown)
+      return Right;
+
+   switch (Binary->Operator.Type)
+   {
+      case EQUAL_EQUAL: return make_bool(is_equal(Context, Left, Right));
+      case BANG_EQUAL:  return make_bool(!is_equal(Context, Left, Right));
+      case PLUS:
+      {
+         if (Left.Type == ValueTypes::Number && Right.Type == ValueTypes::Number)
+            return make_number(Left.Number + Right.Number);
+
+         if (Left.Type == ValueTypes::String && Right.Type == ValueTypes::String)
+            return concatenate(Context, Left.String, Right.String);
+
+         return runtime_error(Context, "Operands must be two numbers or two strings.", Binary->Operator);
+      }
+      default:
+         break;
+   }
+
+   if (Left.Type != ValueTypes::Number || Right.Type != ValueTypes::Number)
+      return runtime_error(Context, "Operands must be numbers.", Binary->Operator);
+
+   switch (Binary->Operator.Type)
+   {
+      case MINUS:         return make_number(Left.Number - Right.Number);
+      case STAR:          return make_number(Left.Number * Right.Number);
+      case SLASH:         return make_number(Left.Number / Right.Number);
+      case GREATER:       return make_bool(Left.Number > Right.Number);
+      case GREATER_EQUAL: return make_bool(Left.Number >= Right.Number);
+      case LESS:          return make_bool(Left.Number < Right.Number);
+      default:            return make_bool(Left.Number <= Right.Number);
+   }
+}
+
+// Long chains such as '1 + 2 + ... + n' lean left, so the left spine is
+// walked in a loop and only right operands recurse. Under the profiler every
+// node down the spine gets its frame before the first operand is evaluated,
+// the order recursion would have entered them in.
+template <bool Profiled>
+static T_Value evaluate_binary(T_LoxContext& Context, const T_BinaryExpr* Binary)
+{
+   std::vector<const T_BinaryExpr*>& spine = Context.Spine;
+   uint32_t                          base  = spine.size();
+
+   spine.push_back(Binary);
+
+   // only interned trees have shared nodes; with them the walk stops early
+   // at a shared operand that already has its value
+   bool           sharing = !Profiled && Context.Intern;
+   T_Expr         first   = Binary->Left;
+   const T_Value* shared  = nullptr;
+
+   if (!sharing)
+      first = push_left_spine(spine, first);
+
+   while (sharing && first.Type == ExprTypes::Binary && first.Expr)
+   {
+      const T_BinaryExpr* binary = (const T_BinaryExpr*)first.Expr;
+
+      if (binary->Shared && (shared = find_shared(Context, binary)))
+         break;
+
+      spine.push_back(binary);
+      first = binary->Left;
+   }
+
+   // the caller has entered the top of the spine
+   if constexpr (Profiled)
+   {
+      for (uint32_t i = base + 1; i < spine.size(); i++)
+         enter_child(*Context.Profile, spine[i - 1]->Left);
+   }
+
+   T_Value value = shared ? *shared : evaluate_node<Profiled>(Context, first);
+
+   for (uint32_t i = spine.size(); i-- > base; )
+   {
+      T_Value right = evaluate_node<Profiled>(Context, spine[i]->Right);
+
+      value = apply_binary(Context, spine[i], value, right);
+
+      if constexpr (Profiled)
+      {
+         if (i > base)
+            leave_node(*Context.Profile);
+      }
+      else if (sharing)
+      {
+         // the top is kept by evaluate_shared
+         if (i > base && spine[i]->Shared)
+            keep_shared(Context, spine[i], value);
+      }
+   }
+
+   spine.resize(base);
+
+   return value;
+}
+
+template <bool Profiled>
+static T_Value evaluate_expr(T_LoxContext& Context, T_Expr Expr)
+{
+   switch (Expr.Type)
+   {
+      case ExprTypes::Binary:
+         return evaluate_binary<Profiled>(Context, (T_BinaryExpr*)Expr.Expr);
+      case ExprTypes::Grouping:
+         return evaluate_node<Profiled>(Context, ((T_GroupingExpr*)Expr.Expr)->Expression);
+      case ExprTypes::Literal:
+         return evaluate_literal((T_LiteralExpr*)Expr.Expr);
+      case ExprTypes::Unary:
+         return evaluate_unary<Profiled>(Context, (T_UnaryExpr*)Expr.Expr);
+      case ExprTypes::Variable:
+         return runtime_error(Context, "Undefined variable.", ((T_VariableExpr*)Expr.Expr)->Name);
+      case ExprTypes::Error:
+         break;
+   }
+
+   T_Value value;
+
+   value.Type   = ValueTypes::Unknown;
+   value.Number = 0.0;
+
+   return value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Shared values
+
+void free_value_cache(T_ValueCache* Cache)
+{
+   delete Cache;
+}
+
+// Slot holding Node's value, or the empty slot where it would go
+static T_SharedValue& find_shared_value(T_ValueCache& Cache, const void* Node)
+{
+   uint32_t mask = Cache.Slots.size() - 1;
+
+   for (uint32_t i = hash_bytes(2166136261u, &Node, sizeof(Node)) & mask; ; i = (i + 1) & mask)
+   {
+      T_SharedValue& slot = Cache.Slots[i];
+
+      if (slot.Generation != Cache.Generation || slot.Node == Node)
+         return slot;
+   }
+}
+
+static void grow_shared_values(T_ValueCache& Cache)
+{
+   std::vector<T_SharedValue> slots(Cache.Slots.size() ? Cache.Slots.size() * 2 : 64);
+
+   Cache.Slots.swap(slots);
+
+   for (const auto& slot : slots)
+   {
+      if (slot.Generation == Cache.Generation)
+         find_shared_value(Cache, slot.Node) = slot;
+   }
+}
+
+static void begin_shared_values(T_LoxContext& Context)
+{
+   if (!Context.Values)
+      Context.Values.reset(new T_ValueCache());
+
+   T_ValueCache& cache = *Context.Values;
+
+   // generation 0 marks never used slots, so it is skipped on wrapping
+   if (++cache.Generation == 0)
+   {
+      for (auto& slot : cache.Slots)
+         slot.Generation = 0;
+
+      cache.Generation = 1;
+   }
+
+   cache.Count = 0;
+
+   if (cache.Slots.empty())
+      grow_shared_values(cache);
+}
+
+// Value Node has been given during this evaluate call, if any
+static const T_Value* find_shared(T_LoxContext& Context, const void* Node)
+{
+   T_ValueCache&  cache = *Context.Values;
+   T_SharedValue& found = find_shared_value(cache, Node);
+
+   return found.Generation == cache.Generation ? &found.Value : nullptr;
+}
+
+static void keep_shared(T_LoxContext& Context, const void* Node, T_Value Value)
+{
+   T_ValueCache& cache = *Context.Values;
+
+   if (Value.Type == ValueTypes::Unknown)
+      return;
+
+   if ((cache.Count + 1) * 2 > cache.Slots.size())
+      grow_shared_values(cache);
+
+   T_SharedValue& slot = find_shared_value(cache, Node);
+
+   if (slot.Generation != cache.Generation)
+      cache.Count++;
+
+   slot = { Node, cache.Generation, Value };
+}
+
+static T_Value evaluate_shared(T_LoxContext& Context, T_Expr Expr)
+{
+   const T_Value* found = find_shared(Context, Expr.Expr);
+
+   if (found)
+      return *found;
+
+   T_Value value = evaluate_expr<false>(Context, Expr);
+
+   keep_shared(Context, Expr.Expr, value);
+
+   return value;
+}
+
+// Shared values
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Profiling
+
+static uint64_t read_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+   return __rdtsc();
+#else
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static uint32_t add_profile_entry(T_Profile& Profile, T_Expr Expr)
+{
+   T_ProfileEntry entry = {};
+
+   entry.Expr        = Expr;
+   entry.Children[0] = UINT32_MAX;
+   entry.Children[1] = UINT32_MAX;
+
+   Profile.Entries.push_back(entry);
+
+   return Profile.Entries.size() - 1;
+}
+
+static void enter_node(T_Profile& Profile, uint32_t Entry)
+{
+   T_ProfileFrame frame = {};
+
+   frame.Entry = Entry;
+
+   // a sampled subtree is timed all the way down, so self time is exact
+   if (Profile.SamplePeriod && (Profile.TimedDepth || --Profile.Countdown == 0))
+   {
+      if (!Profile.TimedDepth)
+         Profile.Countdown = Profile.SamplePeriod;
+
+      Profile.TimedDepth++;
+      frame.Timed = true;
+      frame.Start = read_cycles();
+   }
+
+   Profile.Entries[Entry].Calls++;
+   Profile.Frames.push_back(frame);
+}
+
+static void leave_node(T_Profile& Profile)
+{
+   T_ProfileFrame frame = Profile.Frames.back();
+
+   Profile.Frames.pop_back();
+
+   if (!frame.Timed)
+      return;
+
+   uint64_t        cycles = read_cycles() - frame.Start;
+   T_ProfileEntry& entry  = Profile.Entries[frame.Entry];
+
+   entry.Samples++;
+   entry.Cycles      += cycles;
+   entry.ChildCycles += frame.ChildCycles;
+
+   if (!Profile.Frames.empty())
+      Profile.Frames.back().ChildCycles += cycles;
+
+   Profile.TimedDepth--;
+}
+
+// Children are told apart by the order they are evaluated in, which keeps
+// '1 + 1' as two entries even though both sides are one node
+static void enter_child(T_Profile& Profile, T_Expr Expr)
+{
+   T_ProfileFrame& parent = Profile.Frames.back();
+   uint32_t        slot   = parent.ChildrenSeen++;
+   uint32_t        entry  = Profile.Entries[parent.Entry].Children[slot];
+
+   if (entry == UINT32_MAX)
+   {
+      entry = add_profile_entry(Profile, Expr);
+      Profile.Entries[Profile.Frames.back().Entry].Children[slot] = entry;
+   }
+
+   enter_node(Profile, entry);
+}
+
+template <bool Profiled>
+static T_Value evaluate_node(T_LoxContext& Context, T_Expr Expr)
+{
+   if constexpr (!Profiled)
+   {
+      if (Expr.Type == ExprTypes::Binary && Expr.Expr && ((T_BinaryExpr*)Expr.Expr)->Shared)
+         return evaluate_shared(Context, Expr);
+
+      return evaluate_expr<false>(Context, Expr);
+   }
+   else
+   {
+      enter_child(*Context.Profile, Expr);
+      T_Value value = evaluate_expr<true>(Context, Expr);
+      leave_node(*Context.Profile);
+
+      return value;
+   }
+}
+
+T_Value evaluate(T_LoxContext& Context, T_Expr Expr)
+{
+   begin_shared_values(Context);
+
+   return evaluate_expr<false>(Context, Expr);
+}
+
+T_Value evaluate_profiled(T_LoxContext& Context, T_Profile& Profile, T_Expr Expr)
+{
+   auto     found = Profile.RootEntries.find(Expr.Expr);
+   uint32_t root  = found != Profile.RootEntries.end() ? found->second : UINT32_MAX;
+
+   if (root == UINT32_MAX)
+   {
+      root = add_profile_entry(Profile, Expr);
+      Profile.Roots.push_back(root);
+      Profile.RootEntries[Expr.Expr] = root;
+   }
+
+   Context.Profile = &Profile;
+
+   enter_node(Profile, root);
+   T_Value value = evaluate_expr<true>(Context, Expr);
+   leave_node(Profile);
+
+   Context.Profile = nullptr;
+
+   return value;
+}
+
+void reset_profile(T_Profile& Profile)
+{
+   Profile.Entries.clear();
+   Profile.Roots.clear();
+   Profile.RootEntries.clear();
+   Profile.Frames.clear();
+   Profile.Countdown  = Profile.SamplePeriod;
+   Profile.TimedDepth = 0;
+}
+
+// The token a node is reported by. A grouping has none of its own, so it
+// borrows the first one inside it.
+static const T_Token* profile_token(T_Expr Expr)
+{
+   while (Expr.Type == ExprTypes::Grouping)
+      Expr = ((T_GroupingExpr*)Expr.Expr)->Expression;
+
+   switch (Expr.Type)
+   {
+      case ExprTypes::Binary:   return &((T_BinaryExpr*)Expr.Expr)->Operator;
+      case ExprTypes::Literal:  return &((T_LiteralExpr*)Expr.Expr)->Value;
+      case ExprTypes::Unary:    return &((T_UnaryExpr*)Expr.Expr)->Operator;
+      case ExprTypes::Variable: return &((T_VariableExpr*)Expr.Expr)->Name;
+      case ExprTypes::Error:    return &((T_ErrorExpr*)Expr.Expr)->Error;
+      default:                  return nullptr;
+   }
+}
+
+static bool is_leaf(T_Expr Expr)
+{
+   return Expr.Type != ExprTypes::Binary &&
+          Expr.Type != ExprTypes::Grouping &&
+          Expr.Type != ExprTypes::Unary;
+}
+
+// Cycles over all calls, scaled up from the timed ones
+static uint64_t estimate_cycles(const T_ProfileEntry& Entry, uint64_t Cycles)
+{
+   if (!Entry.Samples)
+      return 0;
+
+   return (uint64_t)((double)Cycles * Entry.Calls / Entry.Samples);
+}
+
+// Reports walk the recorded tree with an explicit stack: a long left-leaning
+// chain records an entry per link, nested as deep as the chain is long
+struct T_ProfileVisit
+{
+   uint32_t Index;
+   uint32_t Depth;
+   uint32_t Closing; // parentheses to close after the entry's own
+   size_t   Length;  // of the folded stack above the entry
+};
+
+static void write_profile_entry(FILE* File, const T_Profile& Profile, T_ProfileVisit Visit,
+                                uint64_t Total, std::vector<T_ProfileVisit>& Pending)
+{
+   const T_ProfileEntry& entry = Profile.Entries[Visit.Index];
+   const T_Token*        token = profile_token(entry.Expr);
+   uint32_t              line  = token ? token->Line : 0;
+
+   if (Profile.SamplePeriod)
+   {
+      uint64_t cycles = estimate_cycles(entry, entry.Cycles);
+      uint64_t self   = estimate_cycles(entry, entry.Cycles - entry.ChildCycles);
+
+      fprintf(File, "%10lu %14lu %14lu %6.1f%% %6u  %*s(", entry.Calls, cycles, self,
+              Total ? 100.0 * cycles / Total : 0.0, line, Visit.Depth * 2, "");
+   }
+   else
+   {
+      fprintf(File, "%10lu %6u  %*s(", entry.Calls, line, Visit.Depth * 2, "");
+   }
+
+   if (entry.Expr.Type == ExprTypes::Grouping)
+      fprintf(File, "group");
+   else if (token)
+      fprintf(File, "%.*s", token->Length, token->Lexeme);
+
+   if (is_leaf(entry.Expr))
+   {
+      for (uint32_t i = 0; i <= Visit.Closing; i++)
+         fputc(')', File);
+
+      fputc('\n', File);
+      return;
+   }
+
+   fprintf(File, "\n");
+
+   uint32_t last = entry.Children[1] != UINT32_MAX ? 1 : 0;
+
+   // pushed last first so the first child is written next
+   for (uint32_t i = last + 1; i-- > 0; )
+   {
+      if (entry.Children[i] != UINT32_MAX)
+         Pending.push_back({ entry.Children[i], Visit.Depth + 1, i == last ? Visit.Closing + 1 : 0, 0 });
+   }
+}
+
+void write_profile_tree(FILE* File, const T_Profile& Profile)
+{
+   uint64_t                    total = 0;
+   std::vector<T_ProfileVisit> pending;
+
+   for (uint32_t root : Profile.Roots)
+      total += estimate_cycles(Profile.Entries[root], Profile.Entries[root].Cycles);
+
+   if (Profile.SamplePeriod)
+      fprintf(File, "%10s %14s %14s %7s %6s  %s\n", "calls", "cycles", "self", "share", "line", "node");
+   else
+      fprintf(File, "%10s %6s  %s\n", "calls", "line", "node");
+
+   for (uint32_t root : Profile.Roots)
+   {
+      pending.push_back({ root, 0, 0, 0 });
+
+      while (!pending.empty())
+      {
+         T_ProfileVisit visit = pending.back();
+
+         pending.pop_back();
+         write_profile_entry(File, Profile, visit, total, pending);
+      }
+   }
+}
+
+// One line per tree position: its frames from the root joined by ';', then
+// its self cycles, or its calls when only counting.
+static void write_profile_stack(FILE* File, const T_Profile& Profile, T_ProfileVisit Visit,
+                                std::string& Stack, std::vector<T_ProfileVisit>& Pending)
+{
+   const T_ProfileEntry& entry = Profile.Entries[Visit.Index];
+   const T_Token*        token = profile_token(entry.Expr);
+
+   Stack.resize(Visit.Length);
+
+   if (Visit.Length)
+      Stack += ';';
+
+   Stack += ExprTypesStr[(int)entry.Expr.Type];
+
+   if (entry.Expr.Type != ExprTypes::Grouping && token)
+   {
+      Stack += ' ';
+
+      // ';' separates frames and the last space comes before the count
+      for (uint32_t i = 0; i < token->Length; i++)
+      {
+         char c = token->Lexeme[i];
+         Stack += (c == ';') ? ':' : (c == ' ' || c == '\n' || c == '\t') ? '_' : c;
+      }
+   }
+
+   if (token)
+      Stack += " line " + std::to_string(token->Line);
+
+   uint64_t value = Profile.SamplePeriod ? estimate_cycles(entry, entry.Cycles - entry.ChildCycles) : entry.Calls;
+
+   if (value)
+      fprintf(File, "%s %lu\n", Stack.c_str(), value);
+
+   for (uint32_t i = 2; i-- > 0; )
+   {
+      if (entry.Children[i] != UINT32_MAX)
+         Pending.push_back({ entry.Children[i], 0, 0, Stack.size() });
+   }
+}
+
+void write_profile_folded(FILE* File, const T_Profile& Profile)
+{
+   std::string                 stack;
+   std::vector<T_ProfileVisit> pending;
+
+   for (uint32_t root : Profile.Roots)
+   {
+      pending.push_back({ root, 0, 0, 0 });
+
+      while (!pending.empty())
+      {
+         T_ProfileVisit visit = pending.back();
+
+         pending.pop_back();
+         write_profile_stack(File, Profile, visit, stack, pending);
+      }
+   }
+}
+
+// Profiling
+///////////////////////////////////////////////////////////////////////////////
+
+uint32_t format_value(char* Buffer, uint32_t Size, T_Value Value)
+{
+   switch (Value.Type)
+   {
+      case ValueTypes::Nil:    return snprintf(Buffer, Size, "nil");
+      case ValueTypes::Bool:   return snprintf(Buffer, Size, "%s", Value.Bool ? "true" : "false");
+      case ValueTypes::Number:
+      {
+         // same text as "%.15g", several times faster than snprintf
+         char     text[32];
+         uint32_t length = std::to_chars(text, text + sizeof(text), Value.Number, std::chars_format::general, 15).ptr - text;
+
+         if (Size)
+         {
+            uint32_t count = length < Size ? length : Size - 1;
+
+            memcpy(Buffer, text, count);
+            Buffer[count] = 0;
+         }
+
+         return length;
+      }
+      case ValueTypes::String:
+      {
+         uint32_t length = string_length(Value.String);
+
+         if (Size)
+         {
+            copy_string(Value.String, Buffer, Size - 1);
+            Buffer[length < Size ? length : Size - 1] = 0;
+         }
+
+         return length;
+      }
+      default:                 return snprintf(Buffer, Size, "error");
+   }
+}
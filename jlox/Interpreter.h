@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdio.h>
+#include <unordered_map>
+#include "Lox.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Interpreter
+//
+// Tree-walking evaluation of a parsed expression. Nodes that type inference
+// specialized run without operand checks. Runtime errors are added to the
+// context's diagnostics and produce a value of type Unknown.
+
+// Runtime strings come in three kinds. Literals are slices that point
+// straight at their token's lexeme. Concatenations that fit are stored
+// inline; longer ones become rope nodes in the context's arena, so a chain of
+// '+' costs linear time and memory. A rope is flattened the first time its
+// bytes are needed contiguously, and the flat copy is cached in the node.
+enum StringKinds : uint8_t
+{
+   STRING_INLINE,
+   STRING_SLICE,
+   STRING_ROPE,
+};
+
+struct T_RopeNode;
+
+struct T_String
+{
+   static constexpr uint32_t INLINE_CAPACITY = 22;
+
+   StringKinds Kind;
+   uint8_t     InlineLength;
+   union
+   {
+      char Inline[INLINE_CAPACITY];
+      struct
+      {
+         const char* Chars;
+         uint32_t    Length;
+      } Slice;
+      T_RopeNode* Rope;
+   };
+};
+
+struct T_RopeNode
+{
+   T_String    Left;
+   T_String    Right;
+   uint32_t    Length;
+   const char* Flat; // nullptr until flattened
+};
+
+struct T_Value
+{
+   ValueTypes Type;
+   union
+   {
+      bool     Bool;
+      double   Number;
+      T_String String; // valid until the next parse
+   };
+};
+
+// Hash-consing makes equal subexpressions one node, so in '(a + b) * (a + b)'
+// both operands are the same Binary, which interning marks Shared. evaluate
+// keeps the value of each shared Binary by address for the rest of the call
+// and evaluates it once. Slots of earlier calls are told apart by their generation, so a call
+// starts without clearing the table. Failures are not kept: every occurrence
+// still reports its own diagnostic. The profiler counts every position and
+// does not use the cache.
+struct T_SharedValue
+{
+   const void* Node;
+   uint32_t    Generation; // slot is empty unless this is the cache's
+   T_Value     Value;
+};
+
+struct T_ValueCache
+{
+   std::vector<T_SharedValue> Slots;
+   uint32_t                   Generation = 0;
+   uint32_t                   Count      = 0; // slots of this generation
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Profiling
+//
+// evaluate_profiled runs the same evaluator instantiated with profiling
+// hooks; evaluate itself has none. Each position in the evaluated tree gets
+// an entry, so a node shared by hash-consing is still reported once per
+// place it appears. Reports take lines from the nodes' tokens, so profiled
+// code is parsed with the context's Intern off to keep every node at its own
+// source position. Entries point at the AST, so reports must be written
+// before the next parse.
+
+// SamplePeriod 0 only counts calls. Otherwise one subtree in every
+// SamplePeriod node evaluations is timed in cycles, 1 timing everything.
+struct T_ProfileEntry
+{
+   T_Expr   Expr;
+   uint32_t Children[2]; // UINT32_MAX until evaluated
+   uint64_t Calls;
+   uint64_t Samples;     // calls that were timed
+   uint64_t Cycles;      // inclusive, timed calls only
+   uint64_t ChildCycles;
+};
+
+struct T_ProfileFrame
+{
+   uint32_t Entry;
+   uint32_t ChildrenSeen;
+   uint64_t Start;
+   uint64_t ChildCycles;
+   bool     Timed;
+};
+
+struct T_Profile
+{
+   std::vector<T_ProfileEntry>         Entries;
+   std::vector<uint32_t>               Roots;       // entry of each distinct statement, first evaluated first
+   std::unordered_map<void*, uint32_t> RootEntries; // statement node to its entry
+   std::vector<T_ProfileFrame>         Frames;
+   uint32_t                            SamplePeriod = 1;
+   uint32_t                            Countdown    = 1;
+   uint32_t                            TimedDepth   = 0;
+};
+
+T_Value     evaluate(T_LoxContext& Context, T_Expr Expr);
+T_Value     evaluate_profiled(T_LoxContext& Context, T_Profile& Profile, T_Expr Expr);
+void        reset_profile(T_Profile& Profile);
+void        write_profile_tree(FILE* File, const T_Profile& Profile);
+void        write_profile_folded(FILE* File, const T_Profile& Profile);
+uint32_t    format_value(char* Buffer, uint32_t Size, T_Value Value);
+uint32_t    string_length(const T_String& String);
+const char* string_chars(T_LoxContext& Context, const T_String& String);
@@ -0,0 +1,1345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <charconv>
+#include <thread>
+#include <system_error>
+#include "Lox.h"
+
+const char* const TokenTypeStr[END_OF_FILE + 1] =
+{
+   "LEFT_PAREN",
+   "RIGHT_PAREN",
+   "LEFT_BRACE",
+   "RIGHT_BRACE",
+   "COMMA",
+   "DOT",
+   "MINUS",
+   "PLUS",
+   "SEMICOLON",
+   "SLASH",
+   "STAR",
+   "BANG",
+   "BANG_EQUAL",
+   "EQUAL",
+   "EQUAL_EQUAL",
+   "GREATER",
+   "GREATER_EQUAL",
+   "LESS",
+   "LESS_EQUAL",
+   "IDENTIFIER",
+   "STRING",
+   "NUMBER",
+   "AND",
+   "CLASS",
+   "ELSE",
+   "FALSE",
+   "FUN",
+   "FOR",
+   "IF",
+   "NIL",
+   "OR",
+   "PRINT",
+   "RETURN",
+   "SUPER",
+   "THIS",
+   "TRUE",
+   "VAR",
+   "WHILE",
+   "END_OF_FILE",
+};
+
+const char* const ExprTypesStr[(int)ExprTypes::Error + 1] =
+{
+   "Binary",
+   "Grouping",
+   "Literal",
+   "Unary",
+   "Variable",
+   "Error",
+};
+
+void report_error(T_LoxContext& Context, const char* Message, uint32_t Line)
+{
+   Context.Diagnostics.push_back({ Message, Line });
+}
+
+void report_error(T_ParseShard& Shard, const char* Message, uint32_t Line)
+{
+   Shard.Diagnostics.push_back({ Shard.Statement, (uint32_t)Shard.Diagnostics.size(), { Message, Line } });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Lexical grammar
+//
+// The lexical grammar is written down once in the rule tables below. The
+// constexpr builders turn it into a 256-entry character class table and a
+// dense DFA transition table, and scan_tokens only walks those tables.
+
+// accept values that are not a TokenType
+static constexpr uint8_t ACCEPT_NONE    = 0xFF;
+static constexpr uint8_t ACCEPT_SKIP    = 0xFE;
+static constexpr uint8_t ACCEPT_NEWLINE = 0xFD;
+
+struct T_SingleCharRule
+{
+   char      Char;
+   TokenType Type;
+};
+
+struct T_TwoCharRule
+{
+   char      First;
+   char      Second;
+   TokenType Single;
+   uint8_t   Double; // ACCEPT_SKIP starts a comment running to the end of the line
+};
+
+static constexpr T_SingleCharRule SingleCharRules[] =
+{
+   { '(', LEFT_PAREN },
+   { ')', RIGHT_PAREN },
+   { '{', LEFT_BRACE },
+   { '}', RIGHT_BRACE },
+   { ',', COMMA },
+   { '.', DOT },
+   { '-', MINUS },
+   { '+', PLUS },
+   { ';', SEMICOLON },
+   { '*', STAR },
+};
+
+static constexpr T_TwoCharRule TwoCharRules[] =
+{
+   { '!', '=', BANG, BANG_EQUAL },
+   { '=', '=', EQUAL, EQUAL_EQUAL },
+   { '<', '=', LESS, LESS_EQUAL },
+   { '>', '=', GREATER, GREATER_EQUAL },
+   { '/', '/', SLASH, ACCEPT_SKIP },
+};
+
+static constexpr char WhitespaceChars[] = " \t\r";
+static constexpr char NewlineChar       = '\n';
+static constexpr char StringQuote       = '"';
+static constexpr char NumberDot         = '.'; // digits may continue after a '.' followed by a digit
+
+enum CharClasses : uint8_t
+{
+   CLASS_OTHER,
+   CLASS_WHITESPACE,
+   CLASS_NEWLINE,
+   CLASS_DIGIT,
+   CLASS_ALPHA,
+   CLASS_QUOTE,
+   CLASS_PUNCTUATION, // first of the per-character punctuation classes
+};
+
+enum LexerStates : uint8_t
+{
+   STATE_DEAD,
+   STATE_START,
+   STATE_WHITESPACE,
+   STATE_NEWLINE,
+   STATE_IDENTIFIER,
+   STATE_NUMBER,
+   STATE_NUMBER_DOT,
+   STATE_STRING,
+   STATE_STRING_END,
+   STATE_RULES, // one state per single-char rule, then two per two-char rule
+};
+
+static constexpr uint32_t STATE_COUNT = STATE_RULES + ArrayCount(SingleCharRules) + 2 * ArrayCount(TwoCharRules);
+
+struct T_CharClassTable
+{
+   uint8_t Class[256];
+   uint8_t Count;
+};
+
+constexpr void add_punctuation_class(T_CharClassTable& Table, char Char)
+{
+   if (Table.Class[(uint8_t)Char] == CLASS_OTHER)
+      Table.Class[(uint8_t)Char] = Table.Count++;
+}
+
+constexpr T_CharClassTable build_char_classes()
+{
+   T_CharClassTable table = {};
+
+   table.Count = CLASS_PUNCTUATION;
+
+   for (uint32_t c = '0'; c <= '9'; c++)
+      table.Class[c] = CLASS_DIGIT;
+
+   for (uint32_t c = 'a'; c <= 'z'; c++)
+      table.Class[c] = CLASS_ALPHA;
+
+   for (uint32_t c = 'A'; c <= 'Z'; c++)
+      table.Class[c] = CLASS_ALPHA;
+
+   for (uint32_t i = 0; WhitespaceChars[i]; i++)
+      table.Class[(uint8_t)WhitespaceChars[i]] = CLASS_WHITESPACE;
+
+   table.Class[(uint8_t)NewlineChar] = CLASS_NEWLINE;
+   table.Class[(uint8_t)StringQuote] = CLASS_QUOTE;
+
+   for (const auto& rule : SingleCharRules)
+      add_punctuation_class(table, rule.Char);
+
+   for (const auto& rule : TwoCharRules)
+   {
+      add_punctuation_class(table, rule.First);
+      add_punctuation_class(table, rule.Second);
+   }
+
+   return table;
+}
+
+static constexpr T_CharClassTable CharClassTable = build_char_classes();
+static constexpr uint32_t         CLASS_COUNT    = CharClassTable.Count;
+
+struct T_LexerTable
+{
+   uint8_t Next[STATE_COUNT][CLASS_COUNT];
+   uint8_t Accept[STATE_COUNT];    // TokenType or ACCEPT_*
+   bool    Accepting[STATE_COUNT];
+};
+
+constexpr uint8_t char_class(char Char)
+{
+   return CharClassTable.Class[(uint8_t)Char];
+}
+
+constexpr void loop_until(T_LexerTable& Table, uint8_t State, uint8_t StopClass)
+{
+   for (uint32_t c = 0; c < CLASS_COUNT; c++)
+   {
+      if (c != StopClass)
+         Table.Next[State][c] = State;
+   }
+}
+
+constexpr T_LexerTable build_lexer_table()
+{
+   T_LexerTable table = {};
+
+   for (uint32_t s = 0; s < STATE_COUNT; s++)
+      table.Accept[s] = ACCEPT_NONE;
+
+   table.Next[STATE_START][CLASS_WHITESPACE] = STATE_WHITESPACE;
+   table.Next[STATE_START][CLASS_NEWLINE]    = STATE_NEWLINE;
+   table.Next[STATE_START][CLASS_DIGIT]      = STATE_NUMBER;
+   table.Next[STATE_START][CLASS_ALPHA]      = STATE_IDENTIFIER;
+   table.Next[STATE_START][CLASS_QUOTE]      = STATE_STRING;
+
+   table.Next[STATE_WHITESPACE][CLASS_WHITESPACE] = STATE_WHITESPACE;
+   table.Accept[STATE_WHITESPACE]                 = ACCEPT_SKIP;
+   table.Accept[STATE_NEWLINE]                    = ACCEPT_NEWLINE;
+
+   table.Next[STATE_IDENTIFIER][CLASS_ALPHA] = STATE_IDENTIFIER;
+   table.Next[STATE_IDENTIFIER][CLASS_DIGIT] = STATE_IDENTIFIER;
+   table.Accept[STATE_IDENTIFIER]            = IDENTIFIER;
+
+   table.Next[STATE_NUMBER][CLASS_DIGIT]           = STATE_NUMBER;
+   table.Next[STATE_NUMBER][char_class(NumberDot)] = STATE_NUMBER_DOT;
+   table.Next[STATE_NUMBER_DOT][CLASS_DIGIT]       = STATE_NUMBER;
+   table.Accept[STATE_NUMBER]                      = NUMBER;
+
+   loop_until(table, STATE_STRING, CLASS_QUOTE);
+   table.Next[STATE_STRING][CLASS_QUOTE] = STATE_STRING_END;
+   table.Accept[STATE_STRING_END]        = STRING;
+
+   uint8_t state = STATE_RULES;
+
+   for (const auto& rule : SingleCharRules)
+   {
+      table.Next[STATE_START][char_class(rule.Char)] = state;
+      table.Accept[state++] = rule.Type;
+   }
+
+   for (const auto& rule : TwoCharRules)
+   {
+      uint8_t first = state++;
+      uint8_t second = state++;
+
+      table.Next[STATE_START][char_class(rule.First)] = first;
+      table.Next[first][char_class(rule.Second)]      = second;
+      table.Accept[first]                             = rule.Single;
+      table.Accept[second]                            = rule.Double;
+
+      if (rule.Double == ACCEPT_SKIP)
+         loop_until(table, second, CLASS_NEWLINE);
+   }
+
+   for (uint32_t s = 0; s < STATE_COUNT; s++)
+      table.Accepting[s] = table.Accept[s] != ACCEPT_NONE;
+
+   return table;
+}
+
+static constexpr T_LexerTable LexerTable = build_lexer_table();
+
+struct T_KeywordRule
+{
+   const char* Lexeme;
+   uint32_t    Length;
+   TokenType   Type;
+};
+
+static constexpr T_KeywordRule KeywordRules[] =
+{
+   { "and", 3, AND },
+   { "class", 5, CLASS },
+   { "else", 4, ELSE },
+   { "false", 5, FALSE },
+   { "for", 3, FOR },
+   { "fun", 3, FUN },
+   { "if", 2, IF },
+   { "nil", 3, NIL },
+   { "or", 2, OR },
+   { "print", 5, PRINT },
+   { "return", 6, RETURN },
+   { "super", 5, SUPER },
+   { "this", 4, THIS },
+   { "true", 4, TRUE },
+   { "var", 3, VAR },
+   { "while", 5, WHILE },
+};
+
+TokenType keyword_type(const char* Lexeme, uint32_t Length)
+{
+   for (const auto& rule : KeywordRules)
+   {
+      if (rule.Length == Length && rule.Lexeme[0] == Lexeme[0] && memcmp(rule.Lexeme, Lexeme, Length) == 0)
+         return rule.Type;
+   }
+
+   return IDENTIFIER;
+}
+
+// Lexical grammar
+///////////////////////////////////////////////////////////////////////////////
+
+void scan_tokens(T_LoxContext& Context, char* String, uint32_t Size)
+{
+   std::vector<T_Token>& Tokens = Context.Tokens;
+   uint32_t              start = 0;
+   uint32_t              line = 1;
+
+   while (start < Size)
+   {
+      uint32_t state        = STATE_START;
+      uint32_t accept_state = STATE_DEAD;
+      uint32_t accept_end   = start;
+      uint32_t current      = start;
+
+      // longest match: run until the DFA dies, remembering the last accept
+      while (current < Size)
+      {
+         state = LexerTable.Next[state][CharClassTable.Class[(uint8_t)String[current]]];
+
+         if (state == STATE_DEAD)
+            break;
+
+         current++;
+
+         bool accepting = LexerTable.Accepting[state];
+         accept_state   = accepting ? state : accept_state;
+         accept_end     = accepting ? current : accept_end;
+      }
+
+      uint8_t accept = LexerTable.Accept[accept_state];
+
+      if (accept == ACCEPT_NONE)
+      {
+         if (String[start] == StringQuote)
+         {
+            report_error(Context, "Unterminated string", line);
+            break;
+         }
+
+         report_error(Context, "Unexpected character", line);
+         start++;
+         continue;
+      }
+
+      uint32_t length = accept_end - start;
+
+      switch (accept)
+      {
+         case ACCEPT_SKIP:
+            break;
+         case ACCEPT_NEWLINE:
+            line++;
+            break;
+         case STRING:
+         {
+            Tokens.push_back({ TokenType::STRING, &String[start + 1], length - 2, line });
+
+            for (uint32_t i = start; i < accept_end; i++)
+               line += String[i] == NewlineChar;
+
+            break;
+         }
+         case IDENTIFIER:
+         {
+            Tokens.push_back({ keyword_type(&String[start], length), &String[start], length, line });
+            break;
+         }
+         default:
+            Tokens.push_back({ (TokenType)accept, &String[start], length, line });
+            break;
+      }
+
+      start = accept_end;
+   }
+
+   Tokens.push_back({ TokenType::END_OF_FILE, nullptr, 0, line });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Parsing functions
+//
+// Nodes live in the arena of the shard doing the parsing. Each one is typed
+// and hash-consed as it is built, see infer_node and intern_expr.
+
+// Large inputs are parsed in parallel, one statement at a time
+static constexpr uint32_t PARALLEL_PARSE_MIN_TOKENS     = 16 * 1024;
+static constexpr uint32_t PARALLEL_PARSE_MIN_STATEMENTS = 64;
+
+// The parser and every later tree walk recurse into groupings, unary operands
+// and right operands, so the parser bounds how deeply groupings and unary
+// operators nest. Past the limit the rest of the statement is skipped. Left
+// operands are not limited: binary chains are built in a loop and walked
+// down their left spine in a loop, see push_left_spine. jlox.h documents the
+// stack the limit needs.
+static constexpr uint32_t MAX_NESTING = 256;
+
+struct T_Parser
+{
+   const T_Token* Tokens;
+   T_ParseShard*  Shard;
+   bool           Intern;
+   int            End;    // token ending the statement
+   uint32_t       Depth;  // unary and grouping recursion
+};
+
+void reset_interner(T_ExprInterner& Interner);
+
+template <typename T>
+T_Expr make_expr(T_Parser& Parser, ExprTypes Type, const T& Node)
+{
+   T_ParseShard& shard = *Parser.Shard;
+   T*            node = shard.Nodes.New<T>();
+
+   *node = Node;
+   infer_node(shard, { Type, node });
+
+   T_Expr expr = { Type, node };
+
+   if (Parser.Intern)
+   {
+      expr = intern_expr(shard.Interner, expr);
+
+      // an identical node already exists, so this one can go straight back
+      if (expr.Expr != node)
+         shard.Nodes.Pop(node, sizeof(T));
+   }
+
+   return expr;
+}
+
+T_Expr make_error(T_Parser& Parser, const T_Token& Token, const char* Message)
+{
+   T_ErrorExpr* error = Parser.Shard->Nodes.New<T_ErrorExpr>();
+
+   error->Error        = Token;
+   error->Error.Lexeme = (char*)Message;
+   error->Error.Length = strlen(Message);
+
+   report_error(*Parser.Shard, Message, Token.Line);
+
+   return { ExprTypes::Error, error };
+}
+
+T_Expr too_deep(T_Parser& Parser, int& Current)
+{
+   T_Expr error = make_error(Parser, Parser.Tokens[Current], "Too deeply nested.");
+
+   Current = Parser.End;
+
+   return error;
+}
+
+T_Expr parse_expression(T_Parser& Parser, int& Current);
+
+T_Expr parse_primary(T_Parser& Parser, int& Current)
+{
+   const T_Token* Tokens = Parser.Tokens;
+
+   if (Tokens[Current].Type == FALSE ||
+       Tokens[Current].Type == TRUE ||
+       Tokens[Current].Type == NIL ||
+       Tokens[Current].Type == NUMBER ||
+       Tokens[Current].Type == STRING)
+   {
+      T_LiteralExpr literal = {};
+
+      literal.Value = Tokens[Current++];
+
+      return make_expr(Parser, ExprTypes::Literal, literal);
+   }
+
+   if (Tokens[Current].Type == IDENTIFIER)
+   {
+      T_VariableExpr variable = {};
+
+      variable.Name = Tokens[Current++];
+
+      return make_expr(Parser, ExprTypes::Variable, variable);
+   }
+
+   if (Tokens[Current].Type == LEFT_PAREN)
+   {
+      T_GroupingExpr grouping = {};
+
+      if (Parser.Depth == MAX_NESTING)
+         return too_deep(Parser, Current);
+
+      Parser.Depth++;
+      grouping.Expression = parse_expression(Parser, ++Current);
+      Parser.Depth--;
+
+      if (grouping.Expression.Type == ExprTypes::Error)
+         return grouping.Expression;
+
+      if (Tokens[Current].Type != RIGHT_PAREN)
+         return make_error(Parser, Tokens[Current], "Expect ')' after expression.");
+
+      Current++;
+
+      return make_expr(Parser, ExprTypes::Grouping, grouping);
+   }
+
+   return make_error(Parser, Tokens[Current], "Expect expression.");
+}
+
+T_Expr parse_unary(T_Parser& Parser, int& Current)
+{
+   const T_Token* Tokens = Parser.Tokens;
+
+   if (Tokens[Current].Type == BANG ||
+       Tokens[Current].Type == MINUS)
+   {
+      T_UnaryExpr unary = {};
+
+      if (Parser.Depth == MAX_NESTING)
+         return too_deep(Parser, Current);
+
+      Parser.Depth++;
+      unary.Operator = Tokens[Current++];
+      unary.Right    = parse_unary(Parser, Current);
+      Parser.Depth--;
+
+      return make_expr(Parser, ExprTypes::Unary, unary);
+   }
+
+   return parse_primary(Parser, Current);
+}
+
+T_Expr parse_factor(T_Parser& Parser, int& Current)
+{
+   const T_Token* Tokens = Parser.Tokens;
+   T_Expr         expr = parse_unary(Parser, Current);
+
+   while (Tokens[Current].Type == SLASH ||
+          Tokens[Current].Type == STAR)
+   {
+      T_BinaryExpr binary = {};
+
+      binary.Operator = Tokens[Current++];
+      binary.Left     = expr;
+      binary.Right    = parse_unary(Parser, Current);
+
+      expr = make_expr(Parser, ExprTypes::Binary, binary);
+   }
+
+   return expr;
+}
+
+T_Expr parse_term(T_Parser& Parser, int& Current)
+{
+   const T_Token* Tokens = Parser.Tokens;
+   T_Expr         expr = parse_factor(Parser, Current);
+
+   while (Tokens[Current].Type == MINUS ||
+          Tokens[Current].Type == PLUS)
+   {
+      T_BinaryExpr binary = {};
+
+      binary.Operator = Tokens[Current++];
+      binary.Left     = expr;
+      binary.Right    = parse_factor(Parser, Current);
+
+      expr = make_expr(Parser, ExprTypes::Binary, binary);
+   }
+
+   return expr;
+}
+
+T_Expr parse_comparison(T_Parser& Parser, int& Current)
+{
+   const T_Token* Tokens = Parser.Tokens;
+   T_Expr         expr = parse_term(Parser, Current);
+
+   while (Tokens[Current].Type == GREATER ||
+          Tokens[Current].Type == GREATER_EQUAL ||
+          Tokens[Current].Type == LESS ||
+          Tokens[Current].Type == LESS_EQUAL)
+   {
+      T_BinaryExpr binary = {};
+
+      binary.Operator = Tokens[Current++];
+      binary.Left     = expr;
+      binary.Right    = parse_term(Parser, Current);
+
+      expr = make_expr(Parser, ExprTypes::Binary, binary);
+   }
+
+   return expr;
+}
+
+T_Expr parse_equality(T_Parser& Parser, int& Current)
+{
+   const T_Token* Tokens = Parser.Tokens;
+   T_Expr         expr = parse_comparison(Parser, Current);
+
+   while (Tokens[Current].Type == BANG_EQUAL ||
+          Tokens[Current].Type == EQUAL_EQUAL)
+   {
+      T_BinaryExpr binary = {};
+
+      binary.Operator = Tokens[Current++];
+      binary.Left     = expr;
+      binary.Right    = parse_comparison(Parser, Current);
+
+      expr = make_expr(Parser, ExprTypes::Binary, binary);
+   }
+
+   return expr;
+}
+
+T_Expr parse_expression(T_Parser& Parser, int& Current)
+{
+   return parse_equality(Parser, Current);
+}
+
+// Statements are split at top-level ';' before any parsing, so each can be
+// parsed on its own. A statement can only end at its own boundary: no rule
+// consumes a ';' or END_OF_FILE. The final ';' is optional.
+void find_statements(T_LoxContext& Context)
+{
+   uint32_t depth = 0;
+   uint32_t begin = 0;
+
+   Context.StatementEnds.clear();
+
+   for (uint32_t i = 0; i < Context.Tokens.size(); i++)
+   {
+      switch (Context.Tokens[i].Type)
+      {
+         case LEFT_PAREN:
+         case LEFT_BRACE:
+            depth++;
+            break;
+         case RIGHT_PAREN:
+         case RIGHT_BRACE:
+            if (depth) depth--;
+            break;
+         case SEMICOLON:
+            if (!depth)
+            {
+               Context.StatementEnds.push_back(i);
+               begin = i + 1;
+            }
+            break;
+         case END_OF_FILE:
+            if (i > begin)
+               Context.StatementEnds.push_back(i);
+            break;
+         default:
+            break;
+      }
+   }
+}
+
+void parse_statement(T_LoxContext& Context, T_ParseShard& Shard, uint32_t Index)
+{
+   int      current = Index ? Context.StatementEnds[Index - 1] + 1 : 0;
+   int      end     = Context.StatementEnds[Index];
+   T_Parser parser  = { Context.Tokens.data(), &Shard, Context.Intern, end, 0 };
+
+   Shard.Statement = Index;
+
+   T_Expr expr = parse_expression(parser, current);
+
+   if (current != end && expr.Type != ExprTypes::Error)
+      expr = make_error(parser, Context.Tokens[current], "Expect ';' after expression.");
+
+   Context.Statements[Index] = expr;
+}
+
+void reset_shard(T_ParseShard& Shard)
+{
+   Shard.Nodes.Reset();
+   reset_interner(Shard.Interner);
+   Shard.Diagnostics.clear();
+}
+
+void parse_tokens(T_LoxContext& Context)
+{
+   find_statements(Context);
+
+   uint32_t count   = Context.StatementEnds.size();
+   uint32_t threads = Context.ParseThreads ? Context.ParseThreads : std::thread::hardware_concurrency();
+
+   if (threads == 0 || count < PARALLEL_PARSE_MIN_STATEMENTS || Context.Tokens.size() < PARALLEL_PARSE_MIN_TOKENS)
+      threads = 1;
+
+   while (Context.Shards.size() < threads)
+      Context.Shards.emplace_back(new T_ParseShard());
+
+   for (uint32_t i = 0; i < threads; i++)
+      reset_shard(*Context.Shards[i]);
+
+   Context.Statements.resize(count);
+
+   auto parse = [&Context](uint32_t Worker, uint32_t Index)
+   {
+      parse_statement(Context, *Context.Shards[Worker], Index);
+   };
+
+   // the workers outlive the parse, so only a change of count starts threads;
+   // small inputs leave them idle rather than stopping them
+   if (threads > 1)
+   {
+      try
+      {
+         Context.ParseWorkers.Resize(threads);
+      }
+      catch (const std::system_error&)
+      {
+         // the pool stays serial, which For handles on this thread
+      }
+
+      Context.ParseWorkers.For(count, parse);
+   }
+   else
+   {
+      for (uint32_t i = 0; i < count; i++)
+         parse(0, i);
+   }
+
+   // shards see statements out of order; put their diagnostics back in
+   // statement order after any from the scanner
+   Context.ParseDiagnostics.clear();
+
+   for (uint32_t i = 0; i < threads; i++)
+   {
+      const auto& diagnostics = Context.Shards[i]->Diagnostics;
+      Context.ParseDiagnostics.insert(Context.ParseDiagnostics.end(), diagnostics.begin(), diagnostics.end());
+   }
+
+   if (threads > 1)
+   {
+      // a statement is parsed by one shard, so Order keeps its diagnostics in
+      // sequence without the buffer std::stable_sort would allocate
+      std::sort(Context.ParseDiagnostics.begin(), Context.ParseDiagnostics.end(),
+                [](const T_ShardDiagnostic& A, const T_ShardDiagnostic& B)
+                {
+                   return A.Statement != B.Statement ? A.Statement < B.Statement : A.Order < B.Order;
+                });
+   }
+
+   for (const auto& diagnostic : Context.ParseDiagnostics)
+      Context.Diagnostics.push_back(diagnostic.Diagnostic);
+}
+
+// Parsing functions
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Type inference
+//
+// The parser builds bottom-up, so inference runs one node at a time as each
+// node is made: its children are already typed. Types start from the literal
+// tokens and are Unknown wherever a variable is involved. Operations that can
+// be proven to fail are reported with the operator's line.
+
+ValueTypes value_type(T_Expr Expr)
+{
+   if (!Expr.Expr)
+      return ValueTypes::Unknown;
+
+   switch (Expr.Type)
+   {
+      case ExprTypes::Binary:   return ((T_BinaryExpr*)Expr.Expr)->ValueType;
+      case ExprTypes::Grouping: return ((T_GroupingExpr*)Expr.Expr)->ValueType;
+      case ExprTypes::Literal:  return ((T_LiteralExpr*)Expr.Expr)->ValueType;
+      case ExprTypes::Unary:    return ((T_UnaryExpr*)Expr.Expr)->ValueType;
+      case ExprTypes::Variable: return ((T_VariableExpr*)Expr.Expr)->ValueType;
+      case ExprTypes::Error:    break;
+   }
+
+   return ValueTypes::Unknown;
+}
+
+// Known to be something other than Type
+bool known_not(ValueTypes Value, ValueTypes Type)
+{
+   return Value != ValueTypes::Unknown && Value != Type;
+}
+
+double parse_number(const T_Token& Token)
+{
+   double number = 0.0;
+
+   // reads the lexeme in place, correctly rounded like strtod but without
+   // needing a NUL-terminated copy
+   if (std::from_chars(Token.Lexeme, Token.Lexeme + Token.Length, number).ec == std::errc())
+      return number;
+
+   // out of range: strtod gives the infinity or denormal Lox expects
+   std::string text(Token.Lexeme, Token.Length);
+   return strtod(text.c_str(), nullptr);
+}
+
+void infer_literal(T_LiteralExpr* Literal)
+{
+   switch (Literal->Value.Type)
+   {
+      case NUMBER:
+         Literal->ValueType = ValueTypes::Number;
+         Literal->Number    = parse_number(Literal->Value);
+         break;
+      case STRING:
+         Literal->ValueType = ValueTypes::String;
+         break;
+      case TRUE:
+      case FALSE:
+         Literal->ValueType = ValueTypes::Bool;
+         break;
+      case NIL:
+         Literal->ValueType = ValueTypes::Nil;
+         break;
+      default:
+         Literal->ValueType = ValueTypes::Unknown;
+         break;
+   }
+}
+
+void infer_unary(T_ParseShard& Shard, T_UnaryExpr* Unary)
+{
+   ValueTypes right = value_type(Unary->Right);
+
+   Unary->Op = OpKinds::Generic;
+
+   if (Unary->Operator.Type == BANG)
+   {
+      Unary->ValueType = ValueTypes::Bool;
+
+      if (right == ValueTypes::Bool)
+         Unary->Op = OpKinds::NotBool;
+
+      return;
+   }
+
+   Unary->ValueType = ValueTypes::Number;
+
+   if (right == ValueTypes::Number)
+      Unary->Op = OpKinds::NegateNumber;
+   else if (known_not(right, ValueTypes::Number))
+      report_error(Shard, "Operand must be a number.", Unary->Operator.Line);
+}
+
+void infer_binary(T_ParseShard& Shard, T_BinaryExpr* Binary)
+{
+   ValueTypes left    = value_type(Binary->Left);
+   ValueTypes right   = value_type(Binary->Right);
+   bool       numbers = left == ValueTypes::Number && right == ValueTypes::Number;
+
+   Binary->Op = OpKinds::Generic;
+
+   switch (Binary->Operator.Type)
+   {
+      case PLUS:
+      {
+         if (numbers)
+         {
+            Binary->ValueType = ValueTypes::Number;
+            Binary->Op        = OpKinds::AddNumber;
+         }
+         else if (left == ValueTypes::String && right == ValueTypes::String)
+         {
+            Binary->ValueType = ValueTypes::String;
+         }
+         else
+         {
+            Binary->ValueType = ValueTypes::Unknown;
+
+            if ((known_not(left, ValueTypes::Number) && known_not(left, ValueTypes::String)) ||
+                (known_not(right, ValueTypes::Number) && known_not(right, ValueTypes::String)) ||
+                (left != ValueTypes::Unknown && right != ValueTypes::Unknown))
+               report_error(Shard, "Operands must be two numbers or two strings.", Binary->Operator.Line);
+         }
+         return;
+      }
+      case MINUS:
+      case STAR:
+      case SLASH:
+      case GREATER:
+      case GREATER_EQUAL:
+      case LESS:
+      case LESS_EQUAL:
+      {
+         bool arithmetic = Binary->Operator.Type == MINUS || Binary->Operator.Type == STAR || Binary->Operator.Type == SLASH;
+
+         Binary->ValueType = arithmetic ? ValueTypes::Number : ValueTypes::Bool;
+
+         if (known_not(left, ValueTypes::Number) || known_not(right, ValueTypes::Number))
+         {
+            report_error(Shard, "Operands must be numbers.", Binary->Operator.Line);
+            return;
+         }
+
+         if (!numbers)
+            return;
+
+         switch (Binary->Operator.Type)
+         {
+            case MINUS:         Binary->Op = OpKinds::SubtractNumber; break;
+            case STAR:          Binary->Op = OpKinds::MultiplyNumber; break;
+            case SLASH:         Binary->Op = OpKinds::DivideNumber; break;
+            case GREATER:       Binary->Op = OpKinds::GreaterNumber; break;
+            case GREATER_EQUAL: Binary->Op = OpKinds::GreaterEqualNumber; break;
+            case LESS:          Binary->Op = OpKinds::LessNumber; break;
+            default:            Binary->Op = OpKinds::LessEqualNumber; break;
+         }
+         return;
+      }
+      default:
+      {
+         // == and != accept any operands
+         Binary->ValueType = ValueTypes::Bool;
+
+         if (numbers)
+            Binary->Op = Binary->Operator.Type == EQUAL_EQUAL ? OpKinds::EqualNumber : OpKinds::NotEqualNumber;
+
+         return;
+      }
+   }
+}
+
+void infer_node(T_ParseShard& Shard, T_Expr Expr)
+{
+   switch (Expr.Type)
+   {
+      case ExprTypes::Binary:
+         infer_binary(Shard, (T_BinaryExpr*)Expr.Expr);
+         break;
+      case ExprTypes::Grouping:
+      {
+         T_GroupingExpr* grouping = (T_GroupingExpr*)Expr.Expr;
+         grouping->ValueType = value_type(grouping->Expression);
+         break;
+      }
+      case ExprTypes::Literal:
+         infer_literal((T_LiteralExpr*)Expr.Expr);
+         break;
+      case ExprTypes::Unary:
+         infer_unary(Shard, (T_UnaryExpr*)Expr.Expr);
+         break;
+      case ExprTypes::Variable:
+         ((T_VariableExpr*)Expr.Expr)->ValueType = ValueTypes::Unknown;
+         break;
+      case ExprTypes::Error:
+         break;
+   }
+}
+
+// Type inference
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Hash-consing
+//
+// The parser builds bottom-up, so by the time a node is interned its
+// children are already canonical and can be hashed and compared by address.
+// Operators and literals compare by lexeme content rather than position, so
+// a shared node keeps the line of its first occurrence.
+
+uint32_t hash_bytes(uint32_t Hash, const void* Data, uint32_t Size)
+{
+   const uint8_t* bytes = (const uint8_t*)Data;
+
+   // FNV-1a
+   for (uint32_t i = 0; i < Size; i++)
+   {
+      Hash ^= bytes[i];
+      Hash *= 16777619u;
+   }
+
+   return Hash;
+}
+
+uint32_t hash_token(uint32_t Hash, const T_Token& Token)
+{
+   Hash = hash_bytes(Hash, &Token.Type, sizeof(Token.Type));
+   return hash_bytes(Hash, Token.Lexeme, Token.Length);
+}
+
+bool token_equal(const T_Token& A, const T_Token& B)
+{
+   return A.Type == B.Type && A.Length == B.Length && memcmp(A.Lexeme, B.Lexeme, A.Length) == 0;
+}
+
+uint32_t node_hash(T_Expr Expr)
+{
+   uint32_t hash = hash_bytes(2166136261u, &Expr.Type, sizeof(Expr.Type));
+
+   switch (Expr.Type)
+   {
+      case ExprTypes::Binary:
+      {
+         T_BinaryExpr* binary = (T_BinaryExpr*)Expr.Expr;
+         hash = hash_token(hash, binary->Operator);
+         hash = hash_bytes(hash, &binary->Left.Expr, sizeof(void*));
+         return hash_bytes(hash, &binary->Right.Expr, sizeof(void*));
+      }
+      case ExprTypes::Grouping:
+      {
+         T_GroupingExpr* grouping = (T_GroupingExpr*)Expr.Expr;
+         return hash_bytes(hash, &grouping->Expression.Expr, sizeof(void*));
+      }
+      case ExprTypes::Literal:
+         return hash_token(hash, ((T_LiteralExpr*)Expr.Expr)->Value);
+      case ExprTypes::Unary:
+      {
+         T_UnaryExpr* unary = (T_UnaryExpr*)Expr.Expr;
+         hash = hash_token(hash, unary->Operator);
+         return hash_bytes(hash, &unary->Right.Expr, sizeof(void*));
+      }
+      case ExprTypes::Variable:
+         return hash_token(hash, ((T_VariableExpr*)Expr.Expr)->Name);
+      case ExprTypes::Error:
+         break;
+   }
+
+   return hash_bytes(hash, &Expr.Expr, sizeof(void*));
+}
+
+bool node_equal(T_Expr A, T_Expr B)
+{
+   if (A.Type != B.Type)
+      return false;
+
+   switch (A.Type)
+   {
+      case ExprTypes::Binary:
+      {
+         T_BinaryExpr* a = (T_BinaryExpr*)A.Expr;
+         T_BinaryExpr* b = (T_BinaryExpr*)B.Expr;
+         return token_equal(a->Operator, b->Operator) && a->Left.Expr == b->Left.Expr && a->Right.Expr == b->Right.Expr;
+      }
+      case ExprTypes::Grouping:
+         return ((T_GroupingExpr*)A.Expr)->Expression.Expr == ((T_GroupingExpr*)B.Expr)->Expression.Expr;
+      case ExprTypes::Literal:
+         return token_equal(((T_LiteralExpr*)A.Expr)->Value, ((T_LiteralExpr*)B.Expr)->Value);
+      case ExprTypes::Unary:
+      {
+         T_UnaryExpr* a = (T_UnaryExpr*)A.Expr;
+         T_UnaryExpr* b = (T_UnaryExpr*)B.Expr;
+         return token_equal(a->Operator, b->Operator) && a->Right.Expr == b->Right.Expr;
+      }
+      case ExprTypes::Variable:
+         return token_equal(((T_VariableExpr*)A.Expr)->Name, ((T_VariableExpr*)B.Expr)->Name);
+      case ExprTypes::Error:
+         break;
+   }
+
+   return A.Expr == B.Expr;
+}
+
+void reset_interner(T_ExprInterner& Interner)
+{
+   // a table grown by one big parse stays big, so only what was filled is
+   // cleared: small parses reset in time proportional to their size
+   for (uint32_t slot : Interner.Filled)
+      Interner.Slots[slot] = T_Expr{};
+
+   Interner.Filled.clear();
+   Interner.Count  = 0;
+   Interner.Shared = 0;
+}
+
+void insert_node(T_ExprInterner& Interner, T_Expr Expr)
+{
+   uint32_t mask = Interner.Slots.size() - 1;
+   uint32_t i    = node_hash(Expr) & mask;
+
+   while (Interner.Slots[i].Expr)
+      i = (i + 1) & mask;
+
+   Interner.Slots[i] = Expr;
+   Interner.Filled.push_back(i);
+   Interner.Count++;
+}
+
+void grow_interner(T_ExprInterner& Interner)
+{
+   std::vector<T_Expr> slots(Interner.Slots.size() ? Interner.Slots.size() * 2 : 256);
+
+   slots.swap(Interner.Slots);
+   Interner.Filled.clear();
+   Interner.Count = 0;
+
+   for (const auto& slot : slots)
+   {
+      if (slot.Expr)
+         insert_node(Interner, slot);
+   }
+}
+
+// A Binary used by two operators, such as 'a + b' in '(a + b) * (a + b)', is
+// evaluated once, see evaluate. Groupings are looked through: they add no
+// evaluation of their own.
+static void add_reference(T_Expr Child)
+{
+   while (Child.Type == ExprTypes::Grouping && Child.Expr)
+      Child = ((T_GroupingExpr*)Child.Expr)->Expression;
+
+   if (Child.Type != ExprTypes::Binary || !Child.Expr)
+      return;
+
+   T_BinaryExpr* binary = (T_BinaryExpr*)Child.Expr;
+
+   binary->Shared     = binary->Referenced;
+   binary->Referenced = true;
+}
+
+// Returns the canonical node for Expr, whose children must already be
+// canonical. Error nodes are never shared.
+T_Expr intern_expr(T_ExprInterner& Interner, T_Expr Expr)
+{
+   if (!Expr.Expr || Expr.Type == ExprTypes::Error)
+      return Expr;
+
+   if ((Interner.Count + 1) * 2 > Interner.Slots.size())
+      grow_interner(Interner);
+
+   uint32_t mask = Interner.Slots.size() - 1;
+   uint32_t i    = node_hash(Expr) & mask;
+
+   for (; Interner.Slots[i].Expr; i = (i + 1) & mask)
+   {
+      if (node_equal(Interner.Slots[i], Expr))
+      {
+         Interner.Shared++;
+         return Interner.Slots[i];
+      }
+   }
+
+   // the probe stopped at the free slot the node belongs in
+   Interner.Slots[i] = Expr;
+   Interner.Filled.push_back(i);
+   Interner.Count++;
+
+   switch (Expr.Type)
+   {
+      case ExprTypes::Binary:
+         add_reference(((T_BinaryExpr*)Expr.Expr)->Left);
+         add_reference(((T_BinaryExpr*)Expr.Expr)->Right);
+         break;
+      case ExprTypes::Unary:
+         add_reference(((T_UnaryExpr*)Expr.Expr)->Right);
+         break;
+      default:
+         break;
+   }
+
+   return Expr;
+}
+
+// Binary chains such as '1 + 2 + ... + n' lean left as deep as they are
+// long, so walks follow the left spine in a loop rather than recursing. The
+// Binary nodes down it are pushed top first; the first operand, which is not
+// a Binary, is returned.
+T_Expr push_left_spine(std::vector<const T_BinaryExpr*>& Spine, T_Expr Expr)
+{
+   while (Expr.Type == ExprTypes::Binary && Expr.Expr)
+   {
+      const T_BinaryExpr* binary = (const T_BinaryExpr*)Expr.Expr;
+
+      Spine.push_back(binary);
+      Expr = binary->Left;
+   }
+
+   return Expr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// AST printing
+
+struct T_TextWriter
+{
+   char*                            Buffer;
+   uint32_t                         Size;
+   uint32_t                         Length; // keeps counting past Size so callers can size a buffer
+   std::vector<const T_BinaryExpr*> Spine;
+};
+
+void write_text(T_TextWriter& Writer, const char* Text, uint32_t Length)
+{
+   if (Writer.Length < Writer.Size)
+   {
+      uint32_t room = Writer.Size - Writer.Length;
+      memcpy(Writer.Buffer + Writer.Length, Text, Length < room ? Length : room);
+   }
+
+   Writer.Length += Length;
+}
+
+void format_node(T_TextWriter& Writer, T_Expr Expr)
+{
+   if (!Expr.Expr)
+      return;
+
+   write_text(Writer, "(", 1);
+   switch(Expr.Type)
+   {
+      case ExprTypes::Binary:
+      {
+         // '(op' for every node down the spine, then the first operand, then
+         // each right operand and ')' on the way back up
+         uint32_t base  = Writer.Spine.size();
+         T_Expr   first = push_left_spine(Writer.Spine, Expr);
+
+         for (uint32_t i = base; i < Writer.Spine.size(); i++)
+         {
+            const T_BinaryExpr* binary = Writer.Spine[i];
+
+            if (i > base)
+               write_text(Writer, "(", 1);
+
+            write_text(Writer, binary->Operator.Lexeme, binary->Operator.Length);
+         }
+
+         format_node(Writer, first);
+
+         for (uint32_t i = Writer.Spine.size(); i-- > base; )
+         {
+            format_node(Writer, Writer.Spine[i]->Right);
+
+            if (i > base)
+               write_text(Writer, ")", 1);
+         }
+
+         Writer.Spine.resize(base);
+         break;
+      }
+      case ExprTypes::Grouping:
+      {
+         T_GroupingExpr* grouping = (T_GroupingExpr*)Expr.Expr;
+         write_text(Writer, "group", 5);
+         format_node(Writer, grouping->Expression);
+         break;
+      }
+      case ExprTypes::Literal:
+      {
+         T_LiteralExpr* literal = (T_LiteralExpr*)Expr.Expr;
+         write_text(Writer, literal->Value.Lexeme, literal->Value.Length);
+         break;
+      }
+      case ExprTypes::Unary:
+      {
+         T_UnaryExpr* unary = (T_UnaryExpr*)Expr.Expr;
+         write_text(Writer, unary->Operator.Lexeme, unary->Operator.Length);
+         format_node(Writer, unary->Right);
+         break;
+      }
+      case ExprTypes::Variable:
+      {
+         T_VariableExpr* variable = (T_VariableExpr*)Expr.Expr;
+         write_text(Writer, variable->Name.Lexeme, variable->Name.Length);
+         break;
+      }
+      case ExprTypes::Error:
+      {
+         T_ErrorExpr* error = (T_ErrorExpr*)Expr.Expr;
+         char         text[128];
+         int          length = snprintf(text, sizeof(text), "\nERROR: %s at line %d\n", error->Error.Lexeme, error->Error.Line);
+         write_text(Writer, text, length);
+         return;
+      }
+   }
+   write_text(Writer, ")", 1);
+}
+
+uint32_t finish_text(T_TextWriter& Writer)
+{
+   if (Writer.Size)
+      Writer.Buffer[Writer.Length < Writer.Size ? Writer.Length : Writer.Size - 1] = 0;
+
+   return Writer.Length;
+}
+
+// Returns the full length of the text, which may exceed Size. The output is
+// NUL-terminated whenever Size is non-zero.
+uint32_t format_ast(char* Buffer, uint32_t Size, T_Expr Expr)
+{
+   T_TextWriter writer = { Buffer, Size, 0, {} };
+
+   format_node(writer, Expr);
+
+   return finish_text(writer);
+}
+
+// One statement per line, same return value as format_ast
+uint32_t format_statements(char* Buffer, uint32_t Size, const T_LoxContext& Context)
+{
+   T_TextWriter writer = { Buffer, Size, 0, {} };
+
+   for (const auto& statement : Context.Statements)
+   {
+      format_node(writer, statement);
+      write_text(writer, "\n", 1);
+   }
+
+   return finish_text(writer);
+}
+
+void print_ast(T_Expr Expr)
+{
+   uint32_t          length = format_ast(nullptr, 0, Expr);
+   std::vector<char> buffer(length + 1);
+
+   format_ast(buffer.data(), buffer.size(), Expr);
+   fwrite(buffer.data(), 1, length, stdout);
+}
+
+// AST printing
+///////////////////////////////////////////////////////////////////////////////
+
+bool lox_parse(T_LoxContext& Context, char* String, uint32_t Size)
+{
+   Context.Tokens.clear();
+   Context.Diagnostics.clear();
+   Context.Nodes.Reset();
+
+   scan_tokens(Context, String, Size);
+   parse_tokens(Context);
+
+   return Context.Diagnostics.empty();
+}
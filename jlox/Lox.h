@@ -0,0 +1,243 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include "Utility.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Lox front end
+//
+// Everything here is reentrant: all state lives in a T_LoxContext, so a
+// thread can reuse one context across many scripts while other threads use
+// their own.
+
+enum TokenType
+{
+   // Single-character tokens
+   LEFT_PAREN,
+   RIGHT_PAREN,
+   LEFT_BRACE,
+   RIGHT_BRACE,
+   COMMA,
+   DOT,
+   MINUS,
+   PLUS,
+   SEMICOLON,
+   SLASH,
+   STAR,
+
+   // One or two character tokens
+   BANG,
+   BANG_EQUAL,
+   EQUAL,
+   EQUAL_EQUAL,
+   GREATER,
+   GREATER_EQUAL,
+   LESS,
+   LESS_EQUAL,
+
+   // Literals
+   IDENTIFIER,
+   STRING,
+   NUMBER,
+
+   // Keywords
+   AND,
+   CLASS,
+   ELSE,
+   FALSE,
+   FUN,
+   FOR,
+   IF,
+   NIL,
+   OR,
+   PRINT,
+   RETURN,
+   SUPER,
+   THIS,
+   TRUE,
+   VAR,
+   WHILE,
+
+   END_OF_FILE,
+};
+
+extern const char* const TokenTypeStr[END_OF_FILE + 1];
+
+struct T_Token
+{
+   TokenType Type;
+   char*     Lexeme;
+   uint32_t  Length;
+   uint32_t  Line;
+};
+
+enum class ExprTypes
+{
+   Binary,
+   Grouping,
+   Literal,
+   Unary,
+   Variable,
+   Error,
+};
+
+extern const char* const ExprTypesStr[(int)ExprTypes::Error + 1];
+
+struct T_Expr
+{
+   ExprTypes Type;
+   void*     Expr;
+   //union
+   //{
+   //   T_BinaryExpr   Binary;
+   //   T_GroupingExpr Grouping;
+   //   T_LiteralExpr  Literal;
+   //   T_UnaryExpr    Unary;
+   //};
+};
+
+// Static type of a node, see infer_node
+enum class ValueTypes
+{
+   Unknown,
+   Nil,
+   Bool,
+   Number,
+   String,
+};
+
+// Operators whose operand types are proven carry a specialized kind that
+// runs without runtime type checks. Generic dispatches on the operator token.
+enum class OpKinds
+{
+   Generic,
+   AddNumber,
+   SubtractNumber,
+   MultiplyNumber,
+   DivideNumber,
+   GreaterNumber,
+   GreaterEqualNumber,
+   LessNumber,
+   LessEqualNumber,
+   EqualNumber,
+   NotEqualNumber,
+   NegateNumber,
+   NotBool,
+};
+
+struct T_BinaryExpr
+{
+   T_Expr     Left;
+   T_Expr     Right;
+   T_Token    Operator;
+   ValueTypes ValueType;
+   OpKinds    Op;
+   bool       Referenced; // an operator uses it, see intern_expr
+   bool       Shared;     // more than one does, see evaluate
+};
+
+struct T_GroupingExpr
+{
+   T_Expr     Expression;
+   ValueTypes ValueType;
+};
+
+struct T_LiteralExpr
+{
+   T_Token    Value;
+   ValueTypes ValueType;
+   double     Number; // parsed value of a NUMBER literal
+};
+
+struct T_UnaryExpr
+{
+   T_Expr     Right;
+   T_Token    Operator;
+   ValueTypes ValueType;
+   OpKinds    Op;
+};
+
+struct T_VariableExpr
+{
+   T_Token    Name;
+   ValueTypes ValueType;
+};
+
+struct T_ErrorExpr
+{
+   T_Token Error;
+};
+
+struct T_Diagnostic
+{
+   const char* Message;
+   uint32_t    Line;
+};
+
+// Open addressing table of canonical nodes, see intern_expr
+struct T_ExprInterner
+{
+   std::vector<T_Expr>   Slots;
+   std::vector<uint32_t> Filled; // index of every used slot
+   uint32_t              Count;
+   uint32_t              Shared;
+};
+
+struct T_ShardDiagnostic
+{
+   uint32_t     Statement;
+   uint32_t     Order;     // reported before any later one of its shard
+   T_Diagnostic Diagnostic;
+};
+
+// Everything one parsing thread writes to. Nodes stay in the shard's arena
+// until the next parse.
+struct T_ParseShard
+{
+   Arena                          Nodes;
+   T_ExprInterner                 Interner;
+   std::vector<T_ShardDiagnostic> Diagnostics;
+   uint32_t                       Statement; // index being parsed
+};
+
+struct T_Profile;
+
+// Values of shared nodes during an evaluation, see Interpreter.h. The
+// context only owns it, so it is freed by the interpreter that knows its
+// layout.
+struct T_ValueCache;
+void free_value_cache(T_ValueCache* Cache);
+typedef std::unique_ptr<T_ValueCache, void (*)(T_ValueCache*)> T_ValueCachePtr;
+
+struct T_LoxContext
+{
+   std::vector<T_Token>                       Tokens;
+   std::vector<T_Diagnostic>                  Diagnostics;
+   std::vector<T_Expr>                        Statements;
+   std::vector<uint32_t>                      StatementEnds;     // token index of each top-level ';' or END_OF_FILE
+   std::vector<std::unique_ptr<T_ParseShard>> Shards;            // shard 0 belongs to the calling thread
+   WorkerPool                                 ParseWorkers;      // started by the first parse that needs them
+   std::vector<T_ShardDiagnostic>             ParseDiagnostics;  // shard diagnostics being merged
+   Arena                                      Nodes;             // evaluation memory
+   std::vector<const T_BinaryExpr*>           Spine;             // left spines being evaluated
+   T_Profile*                                 Profile = nullptr; // set during evaluate_profiled
+   T_ValueCachePtr                            Values = { nullptr, free_value_cache }; // made by the first evaluate
+   uint32_t                                   ParseThreads = 1;  // opt in to parallel parsing; 0 uses every hardware thread
+   bool                                       Intern = true;     // hash-cons nodes; off keeps each at its own source position
+};
+
+void       report_error(T_LoxContext& Context, const char* Message, uint32_t Line);
+void       report_error(T_ParseShard& Shard, const char* Message, uint32_t Line);
+void       scan_tokens(T_LoxContext& Context, char* String, uint32_t Size);
+void       parse_tokens(T_LoxContext& Context);
+bool       lox_parse(T_LoxContext& Context, char* String, uint32_t Size);
+T_Expr     intern_expr(T_ExprInterner& Interner, T_Expr Expr);
+void       infer_node(T_ParseShard& Shard, T_Expr Expr);
+ValueTypes value_type(T_Expr Expr);
+uint32_t   hash_bytes(uint32_t Hash, const void* Data, uint32_t Size);
+T_Expr     push_left_spine(std::vector<const T_BinaryExpr*>& Spine, T_Expr Expr);
+uint32_t   format_ast(char* Buffer, uint32_t Size, T_Expr Expr);
+uint32_t   format_statements(char* Buffer, uint32_t Size, const T_LoxContext& Context);
+void       print_ast(T_Expr Expr);
@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <string.h>
+#include "Memo.h"
+
+// Charged to every entry on top of its key and result: the entry itself and
+// its share of the index, which is kept at most half full.
+static constexpr uint64_t MEMO_ENTRY_OVERHEAD = sizeof(T_MemoEntry) + 2 * sizeof(T_MemoSlot);
+
+static void append_token(std::string& Key, const T_Token& Token)
+{
+   Key += (char)Token.Type;
+   Key.append((const char*)&Token.Length, sizeof(Token.Length));
+   Key.append(Token.Lexeme, Token.Length);
+}
+
+// Appends the canonical form of Expr. Only what evaluation reads goes in:
+// operators by type, numbers by value and other literals by lexeme.
+void canonical_expr(std::string& Key, std::vector<const T_BinaryExpr*>& Spine, T_Expr Expr)
+{
+   while (Expr.Type == ExprTypes::Grouping)
+      Expr = ((T_GroupingExpr*)Expr.Expr)->Expression;
+
+   switch (Expr.Type)
+   {
+      case ExprTypes::Binary:
+      {
+         // prefix form, with the left spine walked in a loop
+         uint32_t base  = Spine.size();
+         T_Expr   first = push_left_spine(Spine, Expr);
+
+         for (uint32_t i = base; i < Spine.size(); i++)
+         {
+            Key += 'B';
+            Key += (char)Spine[i]->Operator.Type;
+         }
+
+         canonical_expr(Key, Spine, first);
+
+         for (uint32_t i = Spine.size(); i-- > base; )
+            canonical_expr(Key, Spine, Spine[i]->Right);
+
+         Spine.resize(base);
+         break;
+      }
+      case ExprTypes::Unary:
+      {
+         T_UnaryExpr* unary = (T_UnaryExpr*)Expr.Expr;
+
+         Key += 'U';
+         Key += (char)unary->Operator.Type;
+         canonical_expr(Key, Spine, unary->Right);
+         break;
+      }
+      case ExprTypes::Literal:
+      {
+         T_LiteralExpr* literal = (T_LiteralExpr*)Expr.Expr;
+
+         if (literal->Value.Type == NUMBER)
+         {
+            Key += 'N';
+            Key.append((const char*)&literal->Number, sizeof(literal->Number));
+         }
+         else
+         {
+            Key += 'L';
+            append_token(Key, literal->Value);
+         }
+         break;
+      }
+      case ExprTypes::Variable:
+         Key += 'V';
+         append_token(Key, ((T_VariableExpr*)Expr.Expr)->Name);
+         break;
+      default:
+         // never equal to anything else
+         Key += 'E';
+         Key.append((const char*)&Expr.Expr, sizeof(Expr.Expr));
+         break;
+   }
+}
+
+// Line of the leftmost token, which diagnostics are stored relative to
+static uint32_t first_line(T_Expr Expr)
+{
+   while (1)
+   {
+      switch (Expr.Type)
+      {
+         case ExprTypes::Binary:   Expr = ((T_BinaryExpr*)Expr.Expr)->Left; break;
+         case ExprTypes::Grouping: Expr = ((T_GroupingExpr*)Expr.Expr)->Expression; break;
+         case ExprTypes::Literal:  return ((T_LiteralExpr*)Expr.Expr)->Value.Line;
+         case ExprTypes::Unary:    return ((T_UnaryExpr*)Expr.Expr)->Operator.Line;
+         case ExprTypes::Variable: return ((T_VariableExpr*)Expr.Expr)->Name.Line;
+         default:                  return ((T_ErrorExpr*)Expr.Expr)->Error.Line;
+      }
+   }
+}
+
+static uint64_t entry_size(uint32_t KeyLength, uint32_t ResultLength)
+{
+   return KeyLength + ResultLength + MEMO_ENTRY_OVERHEAD;
+}
+
+// A reused string keeps its buffer; one far larger than needed is given back
+// so a single huge result cannot stay pinned behind small ones
+static void assign_string(std::string& String, const char* Chars, uint32_t Length)
+{
+   if (String.capacity() / 2 > Length)
+      std::string().swap(String);
+
+   String.assign(Chars, Length);
+}
+
+// Slot holding the entry with this key, or the empty slot where it would go
+static uint32_t find_slot(const T_MemoCache& Cache, bool Record, const char* Key, uint32_t Length, uint32_t Hash)
+{
+   uint32_t mask = Cache.Slots.size() - 1;
+
+   for (uint32_t i = Hash & mask; ; i = (i + 1) & mask)
+   {
+      const T_MemoSlot& slot = Cache.Slots[i];
+
+      if (slot.Entry == MEMO_NONE)
+         return i;
+
+      // the hash in the slot saves touching entries that cannot match
+      if (slot.Hash != Hash)
+         continue;
+
+      const T_MemoEntry& entry = Cache.Entries[slot.Entry];
+
+      if (entry.Record == Record && entry.Key.size() == Length && memcmp(entry.Key.data(), Key, Length) == 0)
+         return i;
+   }
+}
+
+// Backward shift deletion: later entries of the probe run move up so that
+// no tombstones are needed
+static void remove_slot(T_MemoCache& Cache, uint32_t Slot)
+{
+   uint32_t mask = Cache.Slots.size() - 1;
+
+   Cache.Slots[Slot].Entry = MEMO_NONE;
+   Cache.Count--;
+
+   for (uint32_t i = (Slot + 1) & mask; Cache.Slots[i].Entry != MEMO_NONE; i = (i + 1) & mask)
+   {
+      uint32_t home = Cache.Slots[i].Hash & mask;
+
+      // move it unless its home lies cyclically in (Slot, i]
+      if (((i - home) & mask) >= ((i - Slot) & mask))
+      {
+         Cache.Slots[Slot]    = Cache.Slots[i];
+         Cache.Slots[i].Entry = MEMO_NONE;
+         Slot                 = i;
+      }
+   }
+}
+
+static void unlink_entry(T_MemoCache& Cache, uint32_t Index)
+{
+   T_MemoEntry& entry = Cache.Entries[Index];
+
+   if (entry.Newer != MEMO_NONE) Cache.Entries[entry.Newer].Older = entry.Older;
+   else                          Cache.Newest = entry.Older;
+
+   if (entry.Older != MEMO_NONE) Cache.Entries[entry.Older].Newer = entry.Newer;
+   else                          Cache.Oldest = entry.Newer;
+}
+
+static void link_newest(T_MemoCache& Cache, uint32_t Index)
+{
+   T_MemoEntry& entry = Cache.Entries[Index];
+
+   entry.Newer = MEMO_NONE;
+   entry.Older = Cache.Newest;
+
+   if (Cache.Newest != MEMO_NONE) Cache.Entries[Cache.Newest].Newer = Index;
+   else                           Cache.Oldest = Index;
+
+   Cache.Newest = Index;
+}
+
+static const T_MemoEntry* find_entry(T_MemoCache& Cache, bool Record, const char* Key, uint32_t Length, uint32_t Hash)
+{
+   if (!Cache.Count)
+      return nullptr;
+
+   uint32_t index = Cache.Slots[find_slot(Cache, Record, Key, Length, Hash)].Entry;
+
+   if (index == MEMO_NONE)
+      return nullptr;
+
+   unlink_entry(Cache, index);
+   link_newest(Cache, index);
+
+   return &Cache.Entries[index];
+}
+
+static void evict_oldest(T_MemoCache& Cache)
+{
+   uint32_t     index = Cache.Oldest;
+   T_MemoEntry& entry = Cache.Entries[index];
+
+   remove_slot(Cache, find_slot(Cache, entry.Record, entry.Key.data(), entry.Key.size(), entry.Hash));
+   unlink_entry(Cache, index);
+
+   Cache.Bytes -= entry.Charged;
+   Cache.Free.push_back(index);
+   Cache.Stats.Evictions++;
+}
+
+static void grow_slots(T_MemoCache& Cache)
+{
+   std::vector<T_MemoSlot> slots(Cache.Slots.size() ? Cache.Slots.size() * 2 : 1024, T_MemoSlot{ 0, MEMO_NONE });
+   uint32_t                mask = slots.size() - 1;
+
+   for (uint32_t index = Cache.Oldest; index != MEMO_NONE; index = Cache.Entries[index].Newer)
+   {
+      uint32_t i = Cache.Entries[index].Hash & mask;
+
+      while (slots[i].Entry != MEMO_NONE)
+         i = (i + 1) & mask;
+
+      slots[i] = { Cache.Entries[index].Hash, index };
+   }
+
+   Cache.Slots.swap(slots);
+}
+
+// Makes the newest entry for a key known to be missing. It is charged for
+// the capacity its strings end up holding, which a reused entry may have
+// from before, so older entries can have to go after it is filled in too.
+static T_MemoEntry* insert_entry(T_MemoCache& Cache, bool Record, const char* Key, uint32_t Length, uint32_t Hash,
+                                 const char* Result, uint32_t ResultLength)
+{
+   uint64_t size = entry_size(Length, ResultLength);
+
+   if (size > Cache.Limit)
+   {
+      T_MemoEntry* entry = &Cache.Uncached;
+
+      entry->Key.assign(Key, Length);
+      entry->Result.assign(Result, ResultLength);
+      entry->Message = nullptr;
+      entry->Line    = 0;
+      entry->Hash    = Hash;
+      entry->Record  = Record;
+
+      return entry;
+   }
+
+   while (Cache.Bytes + size > Cache.Limit)
+      evict_oldest(Cache);
+
+   if ((Cache.Count + 1) * 2 > Cache.Slots.size())
+      grow_slots(Cache);
+
+   uint32_t index;
+
+   if (!Cache.Free.empty())
+   {
+      index = Cache.Free.back();
+      Cache.Free.pop_back();
+   }
+   else
+   {
+      index = Cache.Entries.size();
+      Cache.Entries.emplace_back();
+   }
+
+   T_MemoEntry& entry = Cache.Entries[index];
+
+   assign_string(entry.Key, Key, Length);
+   assign_string(entry.Result, Result, ResultLength);
+   entry.Message = nullptr;
+   entry.Line    = 0;
+   entry.Charged = entry_size(entry.Key.capacity(), entry.Result.capacity());
+   entry.Hash    = Hash;
+   entry.Record  = Record;
+
+   Cache.Slots[find_slot(Cache, Record, Key, Length, Hash)] = { Hash, index };
+   Cache.Count++;
+   Cache.Bytes += entry.Charged;
+   link_newest(Cache, index);
+
+   while (Cache.Bytes > Cache.Limit && Cache.Oldest != index)
+      evict_oldest(Cache);
+
+   return &entry;
+}
+
+// Evaluates Expr unless an expression of the same shape is cached. Either way
+// a diagnostic is reported to the context as evaluate would, at the lines of
+// this occurrence.
+const T_MemoEntry* memo_evaluate(T_MemoCache& Cache, T_LoxContext& Context, T_Expr Expr)
+{
+   uint32_t line = first_line(Expr);
+
+   Cache.Key.clear();
+   canonical_expr(Cache.Key, Cache.Spine, Expr);
+   Cache.Stats.Lookups++;
+
+   uint32_t           hash  = hash_bytes(2166136261u, Cache.Key.data(), Cache.Key.size());
+   const T_MemoEntry* found = find_entry(Cache, false, Cache.Key.data(), Cache.Key.size(), hash);
+
+   if (found)
+   {
+      if (found->Message)
+         report_error(Context, found->Message, line + found->Line);
+
+      Cache.Stats.Hits++;
+      return found;
+   }
+
+   uint32_t diagnostics = Context.Diagnostics.size();
+   T_Value  value       = evaluate(Context, Expr);
+   bool     failed      = Context.Diagnostics.size() > diagnostics;
+
+   Cache.Result.clear();
+
+   if (!failed)
+   {
+      uint32_t length = format_value(nullptr, 0, value);
+
+      Cache.Result.resize(length + 1);
+      format_value(&Cache.Result[0], length + 1, value);
+      Cache.Result.resize(length);
+   }
+
+   T_MemoEntry* entry = insert_entry(Cache, false, Cache.Key.data(), Cache.Key.size(), hash,
+                                     Cache.Result.data(), Cache.Result.size());
+
+   if (failed)
+   {
+      entry->Message = Context.Diagnostics[diagnostics].Message;
+      entry->Line    = Context.Diagnostics[diagnostics].Line - line;
+   }
+
+   return entry;
+}
+
+// Called once per record before the cache is used for it
+bool memo_awake(T_MemoCache& Cache)
+{
+   if (!Cache.Asleep && Cache.Window == MEMO_WINDOW)
+   {
+      uint64_t hits = Cache.Stats.RecordHits + Cache.Stats.Hits - Cache.WindowHits;
+
+      Cache.Window = 0;
+
+      if (hits * 2 < MEMO_WINDOW)
+      {
+         Cache.Asleep    = Cache.NextSleep;
+         Cache.NextSleep = Cache.NextSleep < MEMO_MAX_SLEEP ? Cache.NextSleep * 2 : MEMO_MAX_SLEEP;
+         Cache.Stats.Sleeps++;
+      }
+      else
+      {
+         Cache.NextSleep = MEMO_FIRST_SLEEP;
+      }
+   }
+
+   if (Cache.Asleep)
+   {
+      Cache.Asleep--;
+      Cache.Stats.SkippedRecords++;
+      return false;
+   }
+
+   if (Cache.Window++ == 0)
+      Cache.WindowHits = Cache.Stats.RecordHits + Cache.Stats.Hits;
+
+   return true;
+}
+
+const T_MemoEntry* memo_find_record(T_MemoCache& Cache, const char* Record, uint32_t Length)
+{
+   const T_MemoEntry* found = find_entry(Cache, true, Record, Length, hash_bytes(2166136261u, Record, Length));
+
+   Cache.Stats.RecordLookups++;
+   Cache.Stats.RecordHits += found != nullptr;
+
+   return found;
+}
+
+// Record must have just missed in memo_find_record
+void memo_store_record(T_MemoCache& Cache, const char* Record, uint32_t Length,
+                       const char* Result, uint32_t ResultLength)
+{
+   insert_entry(Cache, true, Record, Length, hash_bytes(2166136261u, Record, Length), Result, ResultLength);
+}
+
+void write_memo_stats(FILE* File, const T_MemoCache& Cache)
+{
+   const T_MemoStats& stats = Cache.Stats;
+
+   fprintf(File, "memo_lookups %lu\n", (unsigned long)stats.Lookups);
+   fprintf(File, "memo_hits %lu\n", (unsigned long)stats.Hits);
+   fprintf(File, "memo_hit_rate %.4f\n", stats.Lookups ? (double)stats.Hits / stats.Lookups : 0.0);
+   fprintf(File, "memo_record_lookups %lu\n", (unsigned long)stats.RecordLookups);
+   fprintf(File, "memo_record_hits %lu\n", (unsigned long)stats.RecordHits);
+   fprintf(File, "memo_record_hit_rate %.4f\n", stats.RecordLookups ? (double)stats.RecordHits / stats.RecordLookups : 0.0);
+   fprintf(File, "memo_entries %lu\n", (unsigned long)Cache.Count);
+   fprintf(File, "memo_bytes %lu\n", (unsigned long)Cache.Bytes);
+   fprintf(File, "memo_limit %lu\n", (unsigned long)Cache.Limit);
+   fprintf(File, "memo_evictions %lu\n", (unsigned long)stats.Evictions);
+   fprintf(File, "memo_sleeps %lu\n", (unsigned long)stats.Sleeps);
+   fprintf(File, "memo_skipped_records %lu\n", (unsigned long)stats.SkippedRecords);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "Interpreter.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Memoization
+//
+// Evaluation has no side effects, so the outcome of an expression depends
+// only on its shape. A bounded LRU cache maps two kinds of key to the
+// formatted result or the diagnostic:
+//
+//    expressions: the canonical form of a statement's tree, which leaves out
+//                 source positions and groupings and spells numbers by value,
+//                 so '(1 + 2)' on line 9 hits '1.0+2' from line 1
+//    records:     the raw bytes of a whole input, looked up before parsing
+//
+// Entries are evicted least recently used first once the bytes they hold
+// pass the limit, counting the full capacity of their strings. Evicted
+// entries are reused in place, so a full cache no longer allocates unless an
+// entry's buffers are more than twice what its new key or result needs.
+//
+// A miss costs more than evaluating, so a batch of records only gains while
+// they repeat. memo_awake watches the hit rate over windows of MEMO_WINDOW
+// records: after a window where fewer than half hit, the cache sleeps through
+// MEMO_FIRST_SLEEP records, twice as many each time it wakes to another poor
+// window, and keeps its entries for when records start repeating again.
+
+static constexpr uint64_t MEMO_DEFAULT_LIMIT = 64 * 1024 * 1024;
+static constexpr uint32_t MEMO_NONE          = UINT32_MAX;
+static constexpr uint32_t MEMO_WINDOW        = 4096;
+static constexpr uint32_t MEMO_FIRST_SLEEP   = 16 * MEMO_WINDOW;
+static constexpr uint32_t MEMO_MAX_SLEEP     = 1024 * MEMO_WINDOW;
+
+struct T_MemoEntry
+{
+   std::string Key;
+   std::string Result;  // formatted value, or the whole output of a record
+   const char* Message; // diagnostic, nullptr when evaluation succeeded
+   uint32_t    Line;    // diagnostic line after the statement's first line
+   uint64_t    Charged; // bytes counted against the limit
+   uint32_t    Hash;
+   uint32_t    Newer;   // LRU links, MEMO_NONE at either end
+   uint32_t    Older;
+   bool        Record;
+};
+
+struct T_MemoSlot
+{
+   uint32_t Hash;
+   uint32_t Entry; // MEMO_NONE when empty
+};
+
+struct T_MemoStats
+{
+   uint64_t Lookups;
+   uint64_t Hits;
+   uint64_t RecordLookups;
+   uint64_t RecordHits;
+   uint64_t Evictions;
+   uint64_t Sleeps;
+   uint64_t SkippedRecords; // passed by while asleep
+};
+
+struct T_MemoCache
+{
+   std::vector<T_MemoEntry>         Entries;
+   std::vector<uint32_t>            Free;       // entries to reuse
+   std::vector<T_MemoSlot>          Slots;      // open addressing index of entries
+   uint32_t                         Count      = 0;
+   uint32_t                         Newest     = MEMO_NONE;
+   uint32_t                         Oldest     = MEMO_NONE;
+   std::string                      Key;        // canonical form being built
+   std::vector<const T_BinaryExpr*> Spine;      // left spine being walked into Key
+   std::string                      Result;     // value being formatted
+   T_MemoEntry                      Uncached;   // result too large to keep
+   uint64_t                         Limit      = MEMO_DEFAULT_LIMIT;
+   uint64_t                         Bytes      = 0;
+   uint32_t                         Window     = 0; // records seen in this window
+   uint64_t                         WindowHits = 0; // hits before this window
+   uint32_t                         Asleep     = 0; // records left to skip
+   uint32_t                         NextSleep  = MEMO_FIRST_SLEEP;
+   T_MemoStats                      Stats      = {};
+};
+
+// Returned entries stay valid until the next call into the cache
+void               canonical_expr(std::string& Key, std::vector<const T_BinaryExpr*>& Spine, T_Expr Expr);
+const T_MemoEntry* memo_evaluate(T_MemoCache& Cache, T_LoxContext& Context, T_Expr Expr);
+bool               memo_awake(T_MemoCache& Cache);
+const T_MemoEntry* memo_find_record(T_MemoCache& Cache, const char* Record, uint32_t Length);
+void               memo_store_record(T_MemoCache& Cache, const char* Record, uint32_t Length,
+                                     const char* Result, uint32_t ResultLength);
+void               write_memo_stats(FILE* File, const T_MemoCache& Cache);
@@ -0,0 +1,510 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Lox.h"
+#include "Server.h"
+
+// Latency buckets are powers of two in nanoseconds: bucket i counts requests
+// that took less than 2^i ns.
+static constexpr uint32_t LATENCY_BUCKETS = 40;
+
+// Parsing nests up to 256 groupings or unary operators deep, see jlox.h, and
+// needs under 192 KB of stack at the limit. Workers get an explicit stack
+// rather than one sized by whatever RLIMIT_STACK the server was started under.
+static constexpr size_t SERVER_WORKER_STACK_SIZE = 1024 * 1024;
+
+// After an accept failure that leaves the connection queued, the listener is
+// still readable; it is re-armed only after this pause.
+static constexpr uint32_t SERVER_ACCEPT_BACKOFF_MS = 100;
+
+struct T_ServerStats
+{
+   std::atomic<uint64_t> Requests;
+   std::atomic<uint64_t> ParseErrors;
+   std::atomic<uint64_t> Connections;
+   std::atomic<uint64_t> Refused;      // closed at once for want of fds
+   std::atomic<uint64_t> AcceptErrors;
+   std::atomic<uint64_t> Latency[LATENCY_BUCKETS];
+};
+
+struct T_Server
+{
+   int           Listener;
+   int           Poller;
+   int           Reserve; // spare fd given up to refuse a connection when out of fds
+   T_ServerStats Stats;
+};
+
+// Everything a worker reuses between requests
+struct T_ServerWorker
+{
+   T_LoxContext      Context;
+   std::vector<char> Text;
+};
+
+// A connection and the message it is in the middle of. Client sockets are
+// non-blocking: a worker takes whatever has arrived and hands the client back
+// to epoll, so a client that stalls mid-message holds no worker.
+struct T_ServerClient
+{
+   int               Fd;
+   uint32_t          Header[2];
+   uint32_t          Received; // bytes of header and payload read so far
+   std::vector<char> Request;
+   std::string       Response;
+   uint32_t          Sent;     // bytes of Response written so far
+};
+
+enum class IoResult
+{
+   Done,
+   Pending, // the socket would block
+   Closed,
+};
+
+IoResult read_request(T_ServerClient& Client)
+{
+   const uint32_t header = sizeof(Client.Header);
+
+   while (Client.Received < header || Client.Received < header + Client.Header[1])
+   {
+      uint8_t* target;
+      uint32_t wanted;
+
+      if (Client.Received < header)
+      {
+         target = (uint8_t*)Client.Header + Client.Received;
+         wanted = header - Client.Received;
+      }
+      else
+      {
+         target = (uint8_t*)Client.Request.data() + Client.Received - header;
+         wanted = header + Client.Header[1] - Client.Received;
+      }
+
+      ssize_t count = read(Client.Fd, target, wanted);
+
+      if (count < 0 && errno == EINTR)
+         continue;
+
+      if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+         return IoResult::Pending;
+
+      if (count <= 0)
+         return IoResult::Closed;
+
+      Client.Received += count;
+
+      if (Client.Received == header)
+      {
+         if (Client.Header[1] > SERVER_MAX_REQUEST)
+            return IoResult::Closed;
+
+         if (Client.Request.size() < Client.Header[1] + 1)
+            Client.Request.resize(Client.Header[1] + 1);
+      }
+   }
+
+   return IoResult::Done;
+}
+
+IoResult write_response(T_ServerClient& Client)
+{
+   while (Client.Sent < Client.Response.size())
+   {
+      ssize_t count = send(Client.Fd, Client.Response.data() + Client.Sent, Client.Response.size() - Client.Sent, MSG_NOSIGNAL);
+
+      if (count < 0 && errno == EINTR)
+         continue;
+
+      if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+         return IoResult::Pending;
+
+      if (count <= 0)
+         return IoResult::Closed;
+
+      Client.Sent += count;
+   }
+
+   return IoResult::Done;
+}
+
+void append_format(std::string& Text, const char* Format, ...) __attribute__((format(printf, 2, 3)));
+
+void append_format(std::string& Text, const char* Format, ...)
+{
+   char    line[256];
+   va_list args;
+
+   va_start(args, Format);
+   int length = vsnprintf(line, sizeof(line), Format, args);
+   va_end(args);
+
+   Text.append(line, length < (int)sizeof(line) ? length : sizeof(line) - 1);
+}
+
+void record_latency(T_ServerStats& Stats, uint64_t Nanoseconds)
+{
+   uint32_t bucket = 0;
+
+   while (bucket < LATENCY_BUCKETS - 1 && (1ull << bucket) <= Nanoseconds)
+      bucket++;
+
+   Stats.Latency[bucket]++;
+}
+
+uint32_t handle_parse(T_ServerWorker& Worker, T_ServerStats& Stats, T_ServerClient& Client)
+{
+   T_LoxContext& context = Worker.Context;
+   std::string&  response = Client.Response;
+
+   if (!lox_parse(context, Client.Request.data(), Client.Header[1]))
+   {
+      Stats.ParseErrors++;
+
+      for (const auto& diagnostic : context.Diagnostics)
+         append_format(response, "Error: %s at Line %u\n", diagnostic.Message, diagnostic.Line);
+
+      return 1;
+   }
+
+   for (const auto& token : context.Tokens)
+   {
+      response.append(TokenTypeStr[token.Type]);
+      response.push_back(' ');
+      response.append(token.Lexeme ? token.Lexeme : "", token.Length);
+      response.push_back('\n');
+   }
+
+   uint32_t length = format_statements(Worker.Text.data(), Worker.Text.size(), context);
+
+   if (length >= Worker.Text.size())
+   {
+      Worker.Text.resize(length + 1);
+      format_statements(Worker.Text.data(), Worker.Text.size(), context);
+   }
+
+   response.push_back('\n');
+   response.append(Worker.Text.data(), length);
+
+   return 0;
+}
+
+uint32_t handle_stats(T_ServerStats& Stats, T_ServerClient& Client)
+{
+   std::string& response = Client.Response;
+   uint64_t counts[LATENCY_BUCKETS];
+   uint64_t total = 0;
+
+   for (uint32_t i = 0; i < LATENCY_BUCKETS; i++)
+   {
+      counts[i] = Stats.Latency[i];
+      total    += counts[i];
+   }
+
+   append_format(response, "requests %lu\n", (unsigned long)Stats.Requests.load());
+   append_format(response, "parse_errors %lu\n", (unsigned long)Stats.ParseErrors.load());
+   append_format(response, "connections %lu\n", (unsigned long)Stats.Connections.load());
+   append_format(response, "refused_connections %lu\n", (unsigned long)Stats.Refused.load());
+   append_format(response, "accept_errors %lu\n", (unsigned long)Stats.AcceptErrors.load());
+
+   // percentiles are reported as the upper bound of their bucket
+   const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+   for (double percentile : percentiles)
+   {
+      uint64_t seen = 0;
+      uint32_t bucket = 0;
+
+      while (bucket < LATENCY_BUCKETS - 1 && seen + counts[bucket] < percentile * total)
+         seen += counts[bucket++];
+
+      append_format(response, "latency_p%g_ns %llu\n", percentile * 100.0, total ? 1ull << bucket : 0ull);
+   }
+
+   for (uint32_t i = 0; i < LATENCY_BUCKETS; i++)
+   {
+      if (counts[i])
+         append_format(response, "latency_lt_%llu_ns %lu\n", 1ull << i, (unsigned long)counts[i]);
+   }
+
+   return 0;
+}
+
+// Serves the request the client has finished sending and starts writing the
+// response
+IoResult handle_request(T_ServerWorker& Worker, T_ServerStats& Stats, T_ServerClient& Client)
+{
+   auto start = std::chrono::steady_clock::now();
+
+   Client.Request[Client.Header[1]] = 0;
+   Client.Response.assign(sizeof(Client.Header), 0);
+   Client.Received = 0;
+   Client.Sent     = 0;
+
+   uint32_t status;
+
+   if (Client.Header[0] == SERVER_REQUEST_PARSE)
+      status = handle_parse(Worker, Stats, Client);
+   else if (Client.Header[0] == SERVER_REQUEST_STATS)
+      status = handle_stats(Stats, Client);
+   else
+      return IoResult::Closed;
+
+   uint32_t response[2] = { status, (uint32_t)(Client.Response.size() - sizeof(Client.Header)) };
+   memcpy(&Client.Response[0], response, sizeof(response));
+
+   IoResult result = write_response(Client);
+
+   Stats.Requests++;
+   record_latency(Stats, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+
+   return result;
+}
+
+// Makes what progress the socket allows without waiting, at most one request.
+// Returns the event to wait for next, or 0 once the client is gone.
+uint32_t serve_client(T_ServerWorker& Worker, T_ServerStats& Stats, T_ServerClient& Client)
+{
+   IoResult result = write_response(Client);
+
+   if (result == IoResult::Done)
+      result = read_request(Client);
+
+   if (result == IoResult::Done)
+   {
+      result = handle_request(Worker, Stats, Client);
+
+      // epoll reports a request already waiting as soon as this re-arms
+      if (result == IoResult::Done)
+         return EPOLLIN;
+   }
+
+   if (result == IoResult::Pending)
+      return Client.Sent < Client.Response.size() ? EPOLLOUT : EPOLLIN;
+
+   return 0;
+}
+
+// Accepts every queued connection. Only the worker holding the one-shot
+// listener gets here, so the reserve fd needs no lock. Out of fds, accept
+// fails while the connection stays queued and the listener readable, so the
+// reserve is closed to accept that connection and close it at once: the
+// client sees it closed rather than the workers spinning on the listener.
+// Any other failure pauses before the listener is re-armed.
+void accept_clients(T_Server& Server)
+{
+   if (Server.Reserve < 0)
+      Server.Reserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+   while (1)
+   {
+      int fd = accept4(Server.Listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+      if (fd < 0)
+      {
+         int error = errno;
+
+         // an aborted connection is gone from the queue
+         if (error == EINTR || error == ECONNABORTED)
+            continue;
+
+         if (error == EAGAIN || error == EWOULDBLOCK)
+            return;
+
+         if ((error == EMFILE || error == ENFILE) && Server.Reserve >= 0)
+         {
+            close(Server.Reserve);
+            fd    = accept4(Server.Listener, nullptr, nullptr, SOCK_CLOEXEC);
+            error = errno;
+
+            if (fd >= 0)
+               close(fd);
+
+            // another process may take the freed fd first under ENFILE;
+            // the next failure then backs off
+            Server.Reserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+            if (fd >= 0)
+            {
+               fprintf(stderr, "ERROR: Out of file descriptors, closed a new connection.\n");
+               Server.Stats.Refused++;
+               continue;
+            }
+
+            // accept fails for want of an fd before it looks at the queue
+            if (error == EAGAIN || error == EWOULDBLOCK)
+               return;
+         }
+
+         fprintf(stderr, "ERROR: Unable to accept a connection: %s.\n", strerror(error));
+         Server.Stats.AcceptErrors++;
+         std::this_thread::sleep_for(std::chrono::milliseconds(SERVER_ACCEPT_BACKOFF_MS));
+         return;
+      }
+
+      T_ServerClient* accepted = new T_ServerClient();
+      epoll_event     client_event = { EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, {} };
+
+      accepted->Fd          = fd;
+      client_event.data.ptr = accepted;
+
+      if (epoll_ctl(Server.Poller, EPOLL_CTL_ADD, fd, &client_event) < 0)
+      {
+         fprintf(stderr, "ERROR: Unable to watch a connection: %s.\n", strerror(errno));
+         Server.Stats.AcceptErrors++;
+         close(fd);
+         delete accepted;
+         continue;
+      }
+
+      Server.Stats.Connections++;
+   }
+}
+
+// Every fd is registered one-shot, so exactly one worker owns a client while
+// it makes progress on it and re-arms it afterwards. The listener is the one
+// registration without a client.
+void run_worker(T_Server& Server)
+{
+   T_ServerWorker worker;
+
+   // the pool already has a worker per core
+   worker.Context.ParseThreads = 1;
+
+   while (1)
+   {
+      epoll_event event;
+
+      if (epoll_wait(Server.Poller, &event, 1, -1) <= 0)
+         continue;
+
+      T_ServerClient* client = (T_ServerClient*)event.data.ptr;
+
+      if (!client)
+      {
+         accept_clients(Server);
+
+         epoll_event listener_event = { EPOLLIN | EPOLLONESHOT, {} };
+         listener_event.data.ptr = nullptr;
+         epoll_ctl(Server.Poller, EPOLL_CTL_MOD, Server.Listener, &listener_event);
+         continue;
+      }
+
+      uint32_t next = serve_client(worker, Server.Stats, *client);
+
+      if (next)
+      {
+         epoll_event client_event = { next | EPOLLRDHUP | EPOLLONESHOT, {} };
+         client_event.data.ptr = client;
+         epoll_ctl(Server.Poller, EPOLL_CTL_MOD, client->Fd, &client_event);
+      }
+      else
+      {
+         epoll_ctl(Server.Poller, EPOLL_CTL_DEL, client->Fd, nullptr);
+         close(client->Fd);
+         delete client;
+      }
+   }
+}
+
+static void* start_worker(void* Server)
+{
+   run_worker(*(T_Server*)Server);
+   return nullptr;
+}
+
+int run_server(const char* SocketPath)
+{
+   static T_Server server;
+   sockaddr_un     address = {};
+
+   if (strlen(SocketPath) >= sizeof(address.sun_path))
+   {
+      fprintf(stderr, "ERROR: Socket path \"%s\" is too long.\n", SocketPath);
+      return 1;
+   }
+
+   address.sun_family = AF_UNIX;
+   strcpy(address.sun_path, SocketPath);
+
+   // only a socket left behind by an earlier server is ours to replace
+   struct stat existing;
+
+   if (lstat(SocketPath, &existing) == 0)
+   {
+      if (!S_ISSOCK(existing.st_mode))
+      {
+         fprintf(stderr, "ERROR: \"%s\" exists and is not a socket.\n", SocketPath);
+         return 1;
+      }
+
+      unlink(SocketPath);
+   }
+
+   server.Listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+   if (server.Listener < 0 ||
+       bind(server.Listener, (sockaddr*)&address, sizeof(address)) < 0 ||
+       listen(server.Listener, SOMAXCONN) < 0)
+   {
+      fprintf(stderr, "ERROR: Unable to listen on \"%s\": %s.\n", SocketPath, strerror(errno));
+      return 1;
+   }
+
+   server.Poller  = epoll_create1(EPOLL_CLOEXEC);
+   server.Reserve = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+   epoll_event listener_event = { EPOLLIN | EPOLLONESHOT, {} };
+   listener_event.data.ptr = nullptr;
+   epoll_ctl(server.Poller, EPOLL_CTL_ADD, server.Listener, &listener_event);
+
+   uint32_t worker_count = std::thread::hardware_concurrency();
+
+   if (worker_count == 0) worker_count = 1;
+
+   fprintf(stderr, "Serving on %s with %u workers\n", SocketPath, worker_count);
+
+   std::vector<pthread_t> workers;
+   pthread_attr_t         attributes;
+
+   pthread_attr_init(&attributes);
+   pthread_attr_setstacksize(&attributes, SERVER_WORKER_STACK_SIZE);
+
+   for (uint32_t i = 0; i < worker_count; i++)
+   {
+      pthread_t worker;
+      int       error = pthread_create(&worker, &attributes, start_worker, &server);
+
+      if (error)
+      {
+         fprintf(stderr, "ERROR: Unable to start worker %u: %s.\n", i, strerror(error));
+         break;
+      }
+
+      workers.push_back(worker);
+   }
+
+   pthread_attr_destroy(&attributes);
+
+   if (workers.empty())
+      return 1;
+
+   for (pthread_t worker : workers)
+      pthread_join(worker, nullptr);
+
+   return 0;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+///////////////////////////////////////////////////////////////////////////////
+// Parse server
+//
+// jlox --serve <socket> listens on a Unix domain socket. Every message is an
+// 8 byte header followed by Length bytes of payload, all in host byte order:
+//
+//    request:  uint32 Kind ('P' parse or 'S' stats), uint32 Length, payload
+//    response: uint32 Status (0 ok, 1 diagnostics), uint32 Length, text
+//
+// A parse request carries a script; its response holds the token dump and
+// the AST, or the diagnostics. A stats request has no payload and returns
+// request counts and the latency histogram.
+
+static constexpr uint32_t SERVER_REQUEST_PARSE = 'P';
+static constexpr uint32_t SERVER_REQUEST_STATS = 'S';
+static constexpr uint32_t SERVER_MAX_REQUEST   = 16 * 1024 * 1024;
+
+int run_server(const char* SocketPath);
@@ -5,6 +5,13 @@
 #include <sys/stat.h>
 #include <memory.h>
 #include <stdint.h>
+#include <vector>
+#include <new>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
 
 #define ArrayCount(array) sizeof(array)/sizeof(array[0])
 
@@ -17,7 +24,7 @@ struct TBuffer
    uint32_t Count;
 };
 
-TBuffer ReadEntireFile(const char* FileName)
+inline TBuffer ReadEntireFile(const char* FileName)
 {
    TBuffer Result = {};
 
@@ -27,11 +34,14 @@ TBuffer ReadEntireFile(const char* FileName)
       struct stat Stat;
       stat(FileName, &Stat);
 
-      Result.Data = new uint8_t[Stat.st_size];
+      // one extra byte so text consumers can rely on a NUL terminator
+      Result.Data = new uint8_t[Stat.st_size + 1];
       Result.Count = Stat.st_size;
 
       if (Result.Data)
       {
+         Result.Data[Result.Count] = 0;
+
          if (fread(Result.Data, Result.Count, 1, File) != 1)
          {
             fprintf(stderr, "ERROR: Unable to read \"%s\".\n", FileName);
@@ -51,6 +61,348 @@ TBuffer ReadEntireFile(const char* FileName)
    return Result;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Arena
+///////////////////////////////////////////////////////////////////////////////
+class Arena
+{
+public:
+
+   static constexpr uint32_t BLOCK_SIZE = 64 * 1024;
+   static constexpr uint32_t ALIGNMENT  = 8;
+
+   Arena() : mBlock(0), mUsed(0), mBytesUsed(0)
+   {
+   }
+
+   ~Arena()
+   {
+      for (auto& block : mBlocks)
+         delete [] block.Data;
+   }
+
+   Arena(const Arena&) = delete;
+   Arena& operator=(const Arena&) = delete;
+
+   void* Allocate(uint32_t Size)
+   {
+      Size = (Size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+      while (mBlock < mBlocks.size() && mUsed + Size > mBlocks[mBlock].Size)
+      {
+         mBlock++;
+         mUsed = 0;
+      }
+
+      if (mBlock == mBlocks.size())
+      {
+         uint32_t size = Size > BLOCK_SIZE ? Size : BLOCK_SIZE;
+         mBlocks.push_back({ new uint8_t[size], size });
+         mUsed = 0;
+      }
+
+      void* result = mBlocks[mBlock].Data + mUsed;
+      mUsed      += Size;
+      mBytesUsed += Size;
+
+      return result;
+   }
+
+   template <typename T>
+   T* New()
+   {
+      return new (Allocate(sizeof(T))) T();
+   }
+
+   // Gives back the most recent allocation; anything else is left in place
+   void Pop(void* Ptr, uint32_t Size)
+   {
+      Size = (Size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+
+      if (mBlock < mBlocks.size() && mUsed >= Size && (uint8_t*)Ptr == mBlocks[mBlock].Data + mUsed - Size)
+      {
+         mUsed      -= Size;
+         mBytesUsed -= Size;
+      }
+   }
+
+   // Keeps the blocks, so a warmed up arena no longer allocates
+   void Reset()
+   {
+      mBlock     = 0;
+      mUsed      = 0;
+      mBytesUsed = 0;
+   }
+
+   uint64_t BytesUsed()
+   {
+      return mBytesUsed;
+   }
+
+private:
+
+   struct TBlock
+   {
+      uint8_t* Data;
+      uint32_t Size;
+   };
+
+   std::vector<TBlock> mBlocks;
+   uint32_t            mBlock;
+   uint32_t            mUsed;
+   uint64_t            mBytesUsed;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Worker Pool
+///////////////////////////////////////////////////////////////////////////////
+
+// Threads that stay alive between calls to For, so a warmed up pool starts
+// no threads and allocates nothing. The thread calling For is worker 0 and
+// takes part in the work.
+class WorkerPool
+{
+public:
+
+   WorkerPool() : mCount(1), mGeneration(0), mBusy(0), mStop(false), mCall(nullptr), mFn(nullptr)
+   {
+   }
+
+   ~WorkerPool()
+   {
+      Stop();
+   }
+
+   WorkerPool(const WorkerPool&) = delete;
+   WorkerPool& operator=(const WorkerPool&) = delete;
+
+   uint32_t WorkerCount()
+   {
+      return mCount;
+   }
+
+   // Restarts the pool with WorkerCount workers, counting the caller of For.
+   // If the slices or a thread cannot be made the pool is left serial and the
+   // exception is rethrown.
+   void Resize(uint32_t WorkerCount)
+   {
+      if (WorkerCount == 0)
+         WorkerCount = 1;
+
+      if (WorkerCount == mCount)
+         return;
+
+      Stop();
+
+      // serial until every worker has started, so For never waits on a
+      // worker that does not exist
+      mCount = 1;
+      mStop  = false;
+
+      if (WorkerCount == 1)
+         return;
+
+      try
+      {
+         mSlices.reset(new TSlice[WorkerCount]);
+         mThreads.reserve(WorkerCount - 1);
+
+         for (uint32_t i = 1; i < WorkerCount; i++)
+            mThreads.emplace_back(&WorkerPool::Loop, this, i, mGeneration);
+      }
+      catch (...)
+      {
+         Stop();
+         mStop = false;
+         throw;
+      }
+
+      mCount = WorkerCount;
+   }
+
+   // Calls Fn(Worker, Index) for every Index in [0, Count). Each worker starts
+   // on an equal slice of the range; once its own slice runs dry it steals the
+   // back half of another worker's remaining slice. An exception thrown by Fn
+   // is rethrown here once every worker has stopped.
+   template <typename F>
+   void For(uint32_t Count, F& Fn)
+   {
+      if (mCount == 1)
+      {
+         for (uint32_t i = 0; i < Count; i++)
+            Fn(0, i);
+
+         return;
+      }
+
+      for (uint32_t i = 0; i < mCount; i++)
+      {
+         mSlices[i].Begin = (uint64_t)Count * i / mCount;
+         mSlices[i].End   = (uint64_t)Count * (i + 1) / mCount;
+      }
+
+      mCall  = [](void* Fn, uint32_t Worker, uint32_t Index) { (*(F*)Fn)(Worker, Index); };
+      mFn    = &Fn;
+      mError = nullptr;
+
+      {
+         std::lock_guard<std::mutex> lock(mLock);
+         mGeneration++;
+         mBusy = mCount - 1;
+      }
+
+      mWake.notify_all();
+      Work(0);
+
+      std::unique_lock<std::mutex> lock(mLock);
+      mDone.wait(lock, [this] { return mBusy == 0; });
+
+      if (mError)
+         std::rethrow_exception(mError);
+   }
+
+private:
+
+   struct alignas(64) TSlice
+   {
+      std::mutex Lock;
+      uint32_t   Begin;
+      uint32_t   End;
+   };
+
+   void Stop()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mLock);
+         mStop = true;
+      }
+
+      mWake.notify_all();
+
+      for (auto& thread : mThreads)
+         thread.join();
+
+      mThreads.clear();
+   }
+
+   // Generation is the last batch of work handed out before this worker
+   // started, which it must not run
+   void Loop(uint32_t Worker, uint64_t Generation)
+   {
+      uint64_t seen = Generation;
+
+      while (1)
+      {
+         {
+            std::unique_lock<std::mutex> lock(mLock);
+            mWake.wait(lock, [&] { return mStop || mGeneration != seen; });
+
+            if (mStop)
+               return;
+
+            seen = mGeneration;
+         }
+
+         Work(Worker);
+
+         bool last;
+
+         {
+            std::lock_guard<std::mutex> lock(mLock);
+            last = --mBusy == 0;
+         }
+
+         if (last)
+            mDone.notify_one();
+      }
+   }
+
+   void Work(uint32_t Worker)
+   {
+      try
+      {
+         Steal(Worker);
+      }
+      catch (...)
+      {
+         std::lock_guard<std::mutex> lock(mLock);
+
+         if (!mError)
+            mError = std::current_exception();
+      }
+   }
+
+   void Steal(uint32_t Worker)
+   {
+      TSlice& own = mSlices[Worker];
+
+      while (1)
+      {
+         bool     found = false;
+         uint32_t index = 0;
+
+         {
+            std::lock_guard<std::mutex> lock(own.Lock);
+
+            if (own.Begin < own.End)
+            {
+               index = own.Begin++;
+               found = true;
+            }
+         }
+
+         if (found)
+         {
+            mCall(mFn, Worker, index);
+            continue;
+         }
+
+         for (uint32_t i = 1; i < mCount && !found; i++)
+         {
+            TSlice&  victim = mSlices[(Worker + i) % mCount];
+            uint32_t begin = 0;
+            uint32_t end = 0;
+
+            {
+               std::lock_guard<std::mutex> lock(victim.Lock);
+
+               if (victim.Begin < victim.End)
+               {
+                  end        = victim.End;
+                  begin      = victim.End - (victim.End - victim.Begin + 1) / 2;
+                  victim.End = begin;
+                  found      = true;
+               }
+            }
+
+            if (found)
+            {
+               std::lock_guard<std::mutex> lock(own.Lock);
+               own.Begin = begin;
+               own.End   = end;
+            }
+         }
+
+         // nothing left anywhere: work already taken is finished by its taker
+         if (!found)
+            return;
+      }
+   }
+
+   std::unique_ptr<TSlice[]> mSlices;
+   std::vector<std::thread>  mThreads;
+   std::mutex                mLock;
+   std::condition_variable   mWake;
+   std::condition_variable   mDone;
+   std::exception_ptr        mError;
+   uint32_t                  mCount;
+   uint64_t                  mGeneration;
+   uint32_t                  mBusy;
+   bool                      mStop;
+   void                    (*mCall)(void* Fn, uint32_t Worker, uint32_t Index);
+   void*                     mFn;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 // Hash Table
 ///////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,204 @@
+#include <new>
+#include "jlox.h"
+#include "Lox.h"
+
+static_assert((int)ExprTypes::Binary == JLOX_NODE_BINARY &&
+              (int)ExprTypes::Grouping == JLOX_NODE_GROUPING &&
+              (int)ExprTypes::Literal == JLOX_NODE_LITERAL &&
+              (int)ExprTypes::Unary == JLOX_NODE_UNARY &&
+              (int)ExprTypes::Variable == JLOX_NODE_VARIABLE &&
+              (int)ExprTypes::Error == JLOX_NODE_ERROR, "jlox_node_kind must mirror ExprTypes");
+
+static_assert((int)ValueTypes::Unknown == JLOX_TYPE_UNKNOWN &&
+              (int)ValueTypes::Nil == JLOX_TYPE_NIL &&
+              (int)ValueTypes::Bool == JLOX_TYPE_BOOL &&
+              (int)ValueTypes::Number == JLOX_TYPE_NUMBER &&
+              (int)ValueTypes::String == JLOX_TYPE_STRING, "jlox_value_type must mirror ValueTypes");
+
+struct jlox_context
+{
+   T_LoxContext           Context;
+   const jlox_diagnostic* Failure; // why the last jlox_parse failed, its results are dropped
+};
+
+static const jlox_diagnostic OutOfMemoryDiagnostic = { "Out of memory.", 0 };
+static const jlox_diagnostic ParseFailedDiagnostic = { "Parse failed.", 0 };
+
+static jlox_token to_token(const T_Token& Token)
+{
+   return { Token.Type, Token.Lexeme, Token.Length, Token.Line };
+}
+
+static jlox_node to_node(T_Expr Expr)
+{
+   return { (jlox_node_kind)Expr.Type, Expr.Expr };
+}
+
+// Nothing may throw through the C API: failures surface as a NULL context or
+// as the out of memory or parse failed diagnostic.
+jlox_context* jlox_context_create(void)
+{
+   try
+   {
+      return new (std::nothrow) jlox_context();
+   }
+   catch (const std::bad_alloc&)
+   {
+      return nullptr;
+   }
+}
+
+void jlox_context_destroy(jlox_context* context)
+{
+   delete context;
+}
+
+uint32_t jlox_parse(jlox_context* context, const char* source, uint32_t size)
+{
+   context->Failure = nullptr;
+
+   try
+   {
+      lox_parse(context->Context, (char*)source, size);
+   }
+   catch (const std::bad_alloc&)
+   {
+      context->Failure = &OutOfMemoryDiagnostic;
+   }
+   catch (...)
+   {
+      context->Failure = &ParseFailedDiagnostic;
+   }
+
+   if (context->Failure)
+   {
+      // clearing keeps the capacity, so this cannot throw again
+      context->Context.Tokens.clear();
+      context->Context.Diagnostics.clear();
+      context->Context.Statements.clear();
+      return 1;
+   }
+
+   return context->Context.Diagnostics.size();
+}
+
+uint32_t jlox_token_count(const jlox_context* context)
+{
+   return context->Context.Tokens.size();
+}
+
+jlox_token jlox_token_at(const jlox_context* context, uint32_t index)
+{
+   if (index >= context->Context.Tokens.size())
+      return {};
+
+   return to_token(context->Context.Tokens[index]);
+}
+
+const char* jlox_token_type_name(int type)
+{
+   if (type < 0 || type > END_OF_FILE)
+      return nullptr;
+
+   return TokenTypeStr[type];
+}
+
+uint32_t jlox_diagnostic_count(const jlox_context* context)
+{
+   if (context->Failure)
+      return 1;
+
+   return context->Context.Diagnostics.size();
+}
+
+jlox_diagnostic jlox_diagnostic_at(const jlox_context* context, uint32_t index)
+{
+   if (context->Failure)
+      return index == 0 ? *context->Failure : jlox_diagnostic{};
+
+   if (index >= context->Context.Diagnostics.size())
+      return {};
+
+   const T_Diagnostic& diagnostic = context->Context.Diagnostics[index];
+
+   return { diagnostic.Message, diagnostic.Line };
+}
+
+uint32_t jlox_statement_count(const jlox_context* context)
+{
+   return context->Context.Statements.size();
+}
+
+jlox_node jlox_statement_at(const jlox_context* context, uint32_t index)
+{
+   if (index >= context->Context.Statements.size())
+      return {};
+
+   return to_node(context->Context.Statements[index]);
+}
+
+void jlox_set_parse_threads(jlox_context* context, uint32_t threads)
+{
+   context->Context.ParseThreads = threads;
+}
+
+uint32_t jlox_node_child_count(jlox_node node)
+{
+   if (!node.node)
+      return 0;
+
+   switch (node.kind)
+   {
+      case JLOX_NODE_BINARY:   return 2;
+      case JLOX_NODE_GROUPING: return 1;
+      case JLOX_NODE_UNARY:    return 1;
+      default:                 return 0;
+   }
+}
+
+jlox_node jlox_node_child(jlox_node node, uint32_t index)
+{
+   if (index >= jlox_node_child_count(node))
+      return {};
+
+   switch (node.kind)
+   {
+      case JLOX_NODE_BINARY:
+      {
+         const T_BinaryExpr* binary = (const T_BinaryExpr*)node.node;
+         return to_node(index == 0 ? binary->Left : binary->Right);
+      }
+      case JLOX_NODE_GROUPING:
+         return to_node(((const T_GroupingExpr*)node.node)->Expression);
+      case JLOX_NODE_UNARY:
+         return to_node(((const T_UnaryExpr*)node.node)->Right);
+      default:
+         return {};
+   }
+}
+
+jlox_token jlox_node_token(jlox_node node)
+{
+   if (!node.node)
+      return {};
+
+   switch (node.kind)
+   {
+      case JLOX_NODE_BINARY:   return to_token(((const T_BinaryExpr*)node.node)->Operator);
+      case JLOX_NODE_LITERAL:  return to_token(((const T_LiteralExpr*)node.node)->Value);
+      case JLOX_NODE_UNARY:    return to_token(((const T_UnaryExpr*)node.node)->Operator);
+      case JLOX_NODE_VARIABLE: return to_token(((const T_VariableExpr*)node.node)->Name);
+      case JLOX_NODE_ERROR:    return to_token(((const T_ErrorExpr*)node.node)->Error);
+      default:                 return {};
+   }
+}
+
+jlox_value_type jlox_node_value_type(jlox_node node)
+{
+   return (jlox_value_type)value_type({ (ExprTypes)node.kind, (void*)node.node });
+}
+
+uint32_t jlox_ast_format(const jlox_context* context, char* buffer, uint32_t size)
+{
+   return format_statements(buffer, size, context->Context);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// libjlox C API
+//
+// A context scans and parses one buffer at a time and keeps the tokens, AST
+// and diagnostics until the next jlox_parse. Lexemes point into the source
+// buffer, so it must outlive any token or node read from the context.
+//
+// Contexts are independent: use one per thread and reuse it. Once its
+// buffers have grown to fit the largest script seen and any parse threads
+// have started, jlox_parse no longer allocates.
+//
+// Binary chains of any length parse in constant stack, but groupings and
+// unary operators nest through recursion. They are limited to 256 levels,
+// past which a statement reports "Too deeply nested.". Parsing at the limit
+// and printing the AST takes up to 192 KB of stack, so call jlox_parse and
+// jlox_ast_format on a thread with at least 256 KB. Parse threads started by
+// the context get the process default stack size.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct jlox_context jlox_context;
+
+typedef enum jlox_node_kind
+{
+   JLOX_NODE_BINARY,
+   JLOX_NODE_GROUPING,
+   JLOX_NODE_LITERAL,
+   JLOX_NODE_UNARY,
+   JLOX_NODE_VARIABLE,
+   JLOX_NODE_ERROR,
+} jlox_node_kind;
+
+// Static type inferred at parse time
+typedef enum jlox_value_type
+{
+   JLOX_TYPE_UNKNOWN,
+   JLOX_TYPE_NIL,
+   JLOX_TYPE_BOOL,
+   JLOX_TYPE_NUMBER,
+   JLOX_TYPE_STRING,
+} jlox_value_type;
+
+typedef struct jlox_token
+{
+   int         type;   // TokenType, see jlox_token_type_name
+   const char* lexeme; // not NUL-terminated
+   uint32_t    length;
+   uint32_t    line;
+} jlox_token;
+
+typedef struct jlox_diagnostic
+{
+   const char* message;
+   uint32_t    line;
+} jlox_diagnostic;
+
+typedef struct jlox_node
+{
+   jlox_node_kind kind;
+   const void*    node; // NULL when there is no node
+} jlox_node;
+
+// Returns NULL when the context cannot be allocated
+jlox_context*   jlox_context_create(void);
+void            jlox_context_destroy(jlox_context* context);
+
+// Returns the number of diagnostics, 0 when the buffer parsed cleanly. If
+// memory runs out the tokens and statements are dropped and the only
+// diagnostic is "Out of memory."; any other failure inside the parser does
+// the same with "Parse failed.".
+uint32_t        jlox_parse(jlox_context* context, const char* source, uint32_t size);
+
+// Large buffers are parsed on this many threads, the calling thread being one
+// of them; 0 uses every hardware thread. The default, 1, keeps parsing on the
+// calling thread, which suits callers that already run a thread per core.
+// Extra threads are started by the first large parse and kept by the context
+// until it is destroyed or the count changes.
+void            jlox_set_parse_threads(jlox_context* context, uint32_t threads);
+
+uint32_t        jlox_token_count(const jlox_context* context);
+jlox_token      jlox_token_at(const jlox_context* context, uint32_t index);
+const char*     jlox_token_type_name(int type);
+
+uint32_t        jlox_diagnostic_count(const jlox_context* context);
+jlox_diagnostic jlox_diagnostic_at(const jlox_context* context, uint32_t index);
+
+// Statements are in source order
+uint32_t        jlox_statement_count(const jlox_context* context);
+jlox_node       jlox_statement_at(const jlox_context* context, uint32_t index);
+uint32_t        jlox_node_child_count(jlox_node node);
+jlox_node       jlox_node_child(jlox_node node, uint32_t index);
+
+// Operator of a Binary or Unary node, value of a Literal, name of a
+// Variable, message of an Error. Groupings have no token.
+jlox_token      jlox_node_token(jlox_node node);
+jlox_value_type jlox_node_value_type(jlox_node node);
+
+// Writes the parenthesised AST dump, one statement per line, and returns its
+// full length, which may be larger than size. The output is NUL-terminated
+// when size is non-zero.
+uint32_t        jlox_ast_format(const jlox_context* context, char* buffer, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,601 +1,461 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
-#include <ctype.h>
-#include <unordered_map>
 #include <string>
-#include "Utility.h"
-
-enum TokenType
+#include <chrono>
+#include <errno.h>
+#include <unistd.h>
+#include "Lox.h"
+#include "Interpreter.h"
+#include "Memo.h"
+#include "Server.h"
+#include "Columns.h"
+
+void print_diagnostics(const T_LoxContext& Context)
 {
-   // Single-character tokens
-   LEFT_PAREN,
-   RIGHT_PAREN,
-   LEFT_BRACE,
-   RIGHT_BRACE,
-   COMMA,
-   DOT,
-   MINUS,
-   PLUS,
-   SEMICOLON,
-   SLASH,
-   STAR,
-
-   // One or two character tokens
-   BANG,
-   BANG_EQUAL,
-   EQUAL,
-   EQUAL_EQUAL,
-   GREATER,
-   GREATER_EQUAL,
-   LESS,
-   LESS_EQUAL,
-
-   // Literals
-   IDENTIFIER,
-   STRING,
-   NUMBER,
-
-   // Keywords
-   AND,
-   CLASS,
-   ELSE,
-   FALSE,
-   FUN,
-   FOR,
-   IF,
-   NIL,
-   OR,
-   PRINT,
-   RETURN,
-   SUPER,
-   THIS,
-   TRUE,
-   VAR,
-   WHILE,
-
-   END_OF_FILE,
-};
+   for (const auto& diagnostic : Context.Diagnostics)
+      printf("Error: %s at Line %d\n", diagnostic.Message, diagnostic.Line);
+}
 
-const char* TokenTypeStr[END_OF_FILE + 1] =
+// A value is sized before it is formatted: a concatenation can be far longer
+// than any fixed buffer
+void print_value(std::string& Text, T_Value Value)
 {
-   "LEFT_PAREN",
-   "RIGHT_PAREN",
-   "LEFT_BRACE",
-   "RIGHT_BRACE",
-   "COMMA",
-   "DOT",
-   "MINUS",
-   "PLUS",
-   "SEMICOLON",
-   "SLASH",
-   "STAR",
-   "BANG",
-   "BANG_EQUAL",
-   "EQUAL",
-   "EQUAL_EQUAL",
-   "GREATER",
-   "GREATER_EQUAL",
-   "LESS",
-   "LESS_EQUAL",
-   "IDENTIFIER",
-   "STRING",
-   "NUMBER",
-   "AND",
-   "CLASS",
-   "ELSE",
-   "FALSE",
-   "FUN",
-   "FOR",
-   "IF",
-   "NIL",
-   "OR",
-   "PRINT",
-   "RETURN",
-   "SUPER",
-   "THIS",
-   "TRUE",
-   "VAR",
-   "WHILE",
-   "END_OF_FILE",
-};
+   uint32_t length = format_value(nullptr, 0, Value);
 
-struct T_Token
-{
-   TokenType Type;
-   char*     Lexeme;
-   uint32_t  Length;
-   uint32_t  Line;
-};
+   Text.resize(length + 1);
+   format_value(&Text[0], length + 1, Value);
+   Text[length] = '\n';
 
-enum class ExprTypes
-{
-   Binary,
-   Grouping,
-   Literal,
-   Unary,
-   Error,
-};
+   fwrite(Text.data(), 1, length + 1, stdout);
+}
 
-const char* ExprTypesStr[(int)ExprTypes::Error + 1] =
-{
-   "Binary",
-   "Grouping",
-   "Literal",
-   "Unary",
-   "Error",
-};
+///////////////////////////////////////////////////////////////////////////////
+// Column mode
+//
+// Evaluates a one expression script over a table of columns, see Columns.h,
+// and writes the result column as CSV, or binary when its name ends in .bin.
 
-struct T_Expr
+void run_columns(const char* ScriptFile, const char* InputFile, const char* OutputFile)
 {
-   ExprTypes Type;
-   void*     Expr;
-   //union
-   //{
-   //   T_BinaryExpr   Binary;
-   //   T_GroupingExpr Grouping;
-   //   T_LiteralExpr  Literal;
-   //   T_UnaryExpr    Unary;
-   //};
-};
+   TBuffer script = ReadEntireFile(ScriptFile);
+   TBuffer input  = ReadEntireFile(InputFile);
 
-struct T_BinaryExpr
-{
-   T_Expr  Left;
-   T_Expr  Right;
-   T_Token Operator;
-};
+   if (!script.Data || !input.Data)
+      exit(66);
 
-struct T_GroupingExpr
-{
-   T_Expr Expression;
-};
+   T_ColumnTable table  = {};
+   bool          loaded = load_columns(input.Data, input.Count, table);
 
-struct T_LiteralExpr
-{
-   T_Token Value;
-};
+   delete [] input.Data;
 
-struct T_UnaryExpr
-{
-   T_Expr  Right;
-   T_Token Operator;
-};
+   if (!loaded)
+   {
+      fprintf(stderr, "ERROR: Unable to load columns from \"%s\".\n", InputFile);
+      exit(65);
+   }
 
-struct T_ErrorExpr
-{
-   T_Token Error;
-};
+   T_LoxContext context;
+   T_KernelPlan plan = {};
 
-bool had_error = false;
-std::unordered_map<std::string, TokenType> keywords;
+   if (lox_parse(context, (char*)script.Data, script.Count))
+   {
+      if (context.Statements.size() == 1)
+         plan.Result = compile_kernel(context, plan, table, context.Statements[0]);
+      else
+         report_error(context, "Expect a single expression.", 1);
+   }
 
-void print_error(const char* Message, int Line)
-{
-   printf("Error: %s at Line %d\n", Message, Line);
-   had_error = true;
-}
+   if (!context.Diagnostics.empty())
+   {
+      print_diagnostics(context);
+      exit(65);
+   }
 
-void scan_tokens(char* String, uint32_t Size, std::vector<T_Token>& Tokens)
-{
-   std::vector<T_Token> tokens;
-   uint32_t             start = 0;
-   uint32_t             current = 0;
-   uint32_t             line = 1;
+   std::vector<double> output(table.Rows);
+   uint32_t            thread_count;
 
-   while (current < Size)
-   {
-      switch (String[current])
-      {
-         case '(':
-            Tokens.push_back({ TokenType::LEFT_PAREN, &String[current], 1, line });
-            break;
-         case ')':
-            Tokens.push_back({ TokenType::RIGHT_PAREN, &String[current], 1, line });
-            break;
-         case '{':
-            Tokens.push_back({ TokenType::LEFT_BRACE, &String[current], 1, line });
-            break;
-         case '}':
-            Tokens.push_back({ TokenType::RIGHT_BRACE, &String[current], 1, line });
-            break;
-         case ',':
-            Tokens.push_back({ TokenType::COMMA, &String[current], 1, line });
-            break;
-         case '.':
-            Tokens.push_back({ TokenType::DOT, &String[current], 1, line });
-            break;
-         case '-':
-            Tokens.push_back({ TokenType::MINUS, &String[current], 1, line });
-            break;
-         case '+':
-            Tokens.push_back({ TokenType::PLUS, &String[current], 1, line });
-            break;
-         case ';':
-            Tokens.push_back({ TokenType::SEMICOLON, &String[current], 1, line });
-            break;
-         case '*':
-            Tokens.push_back({ TokenType::STAR, &String[current], 1, line });
-            break;
-         case '!':
-            if (String[current+1] == '=')
-            {
-               Tokens.push_back({ TokenType::BANG_EQUAL, &String[current], 2, line });
-               current++;
-            }
-            else
-            {
-               Tokens.push_back({ TokenType::BANG, &String[current], 1, line });
-            }
-            break;
-         case '=':
-            if (String[current+1] == '=')
-            {
-               Tokens.push_back({ TokenType::EQUAL_EQUAL, &String[current], 2, line });
-               current++;
-            }
-            else
-            {
-               Tokens.push_back({ TokenType::EQUAL, &String[current], 1, line });
-            }
-            break;
-         case '<':
-            if (String[current+1] == '=')
-            {
-               Tokens.push_back({ TokenType::LESS_EQUAL, &String[current], 2, line });
-               current++;
-            }
-            else
-            {
-               Tokens.push_back({ TokenType::LESS, &String[current], 1, line });
-            }
-            break;
-         case '>':
-            if (String[current+1] == '=')
-            {
-               Tokens.push_back({ TokenType::GREATER_EQUAL, &String[current], 2, line });
-               current++;
-            }
-            else
-            {
-               Tokens.push_back({ TokenType::GREATER, &String[current], 1, line });
-            }
-            break;
-         case '/':
-            if (String[current+1] == '/')
-            {
-               while (current != '\n' && current < Size)
-                  current++;
-            }
-            else
-            {
-               Tokens.push_back({ TokenType::SLASH, &String[current], 1, line });
-            }
-            break;
-         case '"':
-            current++;
-            start = current;
-            while (String[current] != '"' && current < Size)
-            {
-               if (current == '\n')
-                  line++;
-
-               current++;
-            }
-
-            if (current == Size)
-               print_error("Unterminated string", line);
-            else
-            {
-               Tokens.push_back({ TokenType::STRING, &String[start], current - start, line });
-            }
-            break;
-         case ' ':
-         case '\t':
-         case '\r':
-            // ignore whitespace
-            break;
-         case '\n':
-            line++;
-            break;
-         default:
-            if (isdigit(String[current]))
-            {
-               start = current++;
-               while ((isdigit(String[current]) || (String[current] == '.' && isdigit(String[current+1]))) && current < Size)
-               {
-                  current++;
-               }
-
-               Tokens.push_back({ TokenType::NUMBER, &String[start], current - start, line });
-               current--;
-            }
-            else if (isalpha(String[current]))
-            {
-               start = current++;
-               while (isalnum(String[current]) && current < Size)
-               {
-                  current++;
-               }
-
-               std::string token(&String[start], current - start);
-               TokenType type = TokenType::IDENTIFIER;
-
-               if (keywords.find(token) != keywords.end())
-                  type = keywords[token];
-
-               Tokens.push_back({ type, &String[start], current - start, line });
-               current--;
-            }
-            else
-            {
-               print_error("Unexpected character", line);
-            }
-      }
+   auto start = std::chrono::steady_clock::now();
+   run_kernel(plan, table, output.data(), thread_count);
+   auto end = std::chrono::steady_clock::now();
 
-      current++;
-   }
+   double seconds = std::chrono::duration<double>(end - start).count();
 
-   Tokens.push_back({ TokenType::END_OF_FILE, nullptr, 0, line });
+   fprintf(stderr, "Evaluated %u rows on %u threads in %.3f ms (%.2f M rows/sec)\n",
+           table.Rows, thread_count, seconds * 1000.0, seconds > 0.0 ? table.Rows / seconds / 1e6 : 0.0);
+
+   write_column(OutputFile, plan.Registers[plan.Result].Kind, output);
+   delete [] script.Data;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Parsing functions
-
-T_Expr parse_expression(const std::vector<T_Token>& Tokens, int& Current);
 
-T_Expr parse_primary(const std::vector<T_Token>& Tokens, int& Current)
+bool run(T_LoxContext& Context, T_MemoCache* Memo, char* String, uint32_t Size)
 {
-   T_Expr expr = {};
+   printf("Scanning\n");
+   lox_parse(Context, String, Size);
 
-   if (Tokens[Current].Type == FALSE ||
-       Tokens[Current].Type == TRUE ||
-       Tokens[Current].Type == NIL ||
-       Tokens[Current].Type == NUMBER ||
-       Tokens[Current].Type == STRING)
+   printf("Tokens %ld\n", Context.Tokens.size());
+   for (const auto& token : Context.Tokens)
    {
-      T_LiteralExpr* literal = new T_LiteralExpr;
+      printf("Type %s (%d): %.*s\n", TokenTypeStr[token.Type], token.Type, token.Length, token.Lexeme);
+   }
 
-      literal->Value = Tokens[Current++];
+   printf("\nParsing\n");
 
-      expr.Type = ExprTypes::Literal;
-      expr.Expr = literal;
+   if (!Context.Diagnostics.empty())
+   {
+      print_diagnostics(Context);
+      return false;
    }
 
-   if (Tokens[Current].Type == LEFT_PAREN)
+   // print AST tree
+   for (const auto& statement : Context.Statements)
    {
-      T_GroupingExpr* grouping = new T_GroupingExpr;
+      print_ast(statement);
+      printf("\n");
+   }
 
-      grouping->Expression = parse_expression(Tokens, ++Current);
+   printf("\nEvaluating\n");
 
-      if (Tokens[Current].Type == RIGHT_PAREN)
+   std::string text;
+
+   for (const auto& statement : Context.Statements)
+   {
+      if (Memo)
       {
-         expr.Type = ExprTypes::Grouping;
-         expr.Expr = grouping;
+         const T_MemoEntry* entry = memo_evaluate(*Memo, Context, statement);
+
+         if (!Context.Diagnostics.empty())
+         {
+            print_diagnostics(Context);
+            return false;
+         }
+
+         printf("%.*s\n", (int)entry->Result.size(), entry->Result.data());
+         continue;
       }
-      else
+
+      T_Value value = evaluate(Context, statement);
+
+      if (!Context.Diagnostics.empty())
       {
-         delete grouping;
-         T_ErrorExpr* error = new T_ErrorExpr;
-
-         error->Error = Tokens[Current];
-         error->Error.Lexeme = (char*)"Expect ')' after expression.";
-         error->Error.Length = strlen("Expect ')' after expression.");
-         
-         expr.Type = ExprTypes::Error;
-         expr.Expr = error;
+         print_diagnostics(Context);
+         return false;
       }
+
+      print_value(text, value);
    }
 
-   return expr;
+   return true;
 }
 
-T_Expr parse_unary(const std::vector<T_Token>& Tokens, int& Current)
+///////////////////////////////////////////////////////////////////////////////
+// Profiling
+//
+// Evaluates every statement of a script with the profiler on, then prints
+// the annotated tree and optionally writes folded stacks for flamegraph.pl.
+
+void run_profile(const char* Filename, uint32_t SamplePeriod, const char* FoldedFilename)
 {
-   if (Tokens[Current].Type == BANG ||
-       Tokens[Current].Type == MINUS)
+   TBuffer      buffer = ReadEntireFile(Filename);
+   T_LoxContext context;
+   T_Profile    profile;
+
+   if (!buffer.Data)
    {
-      T_UnaryExpr* unary = new T_UnaryExpr;
+      fprintf(stderr, "ERROR: Unable to open \"%s\".\n", Filename);
+      exit(66);
+   }
 
-      unary->Operator = Tokens[Current++];
-      unary->Right    = parse_unary(Tokens, Current);
+   profile.SamplePeriod = SamplePeriod;
+   reset_profile(profile);
+   context.ParseThreads = 0;
+   context.Intern       = false;
 
-      return { ExprTypes::Unary, unary };
+   if (!lox_parse(context, (char*)buffer.Data, buffer.Count))
+   {
+      print_diagnostics(context);
+      exit(65);
    }
 
-   return parse_primary(Tokens, Current);
-}
+   std::string text;
 
-T_Expr parse_factor(const std::vector<T_Token>& Tokens, int& Current)
-{
-   T_Expr expr = {};
+   for (const auto& statement : context.Statements)
+   {
+      T_Value value = evaluate_profiled(context, profile, statement);
+
+      if (!context.Diagnostics.empty())
+      {
+         print_diagnostics(context);
+         exit(70);
+      }
+
+      print_value(text, value);
+   }
 
-   expr = parse_unary(Tokens, Current);
+   printf("\nProfile\n");
+   write_profile_tree(stdout, profile);
 
-   while (Tokens[Current].Type == SLASH ||
-          Tokens[Current].Type == STAR)
+   if (FoldedFilename)
    {
-      T_BinaryExpr* binary = new T_BinaryExpr;
+      FILE* file = fopen(FoldedFilename, "w");
 
-      binary->Operator = Tokens[Current++];
-      binary->Left     = expr;
-      binary->Right    = parse_unary(Tokens, Current);
+      if (!file)
+      {
+         fprintf(stderr, "ERROR: Unable to open \"%s\".\n", FoldedFilename);
+         exit(73);
+      }
 
-      expr.Type = ExprTypes::Binary;
-      expr.Expr = binary;
+      write_profile_folded(file, profile);
+      fclose(file);
    }
 
-   return expr;
+   delete [] buffer.Data;
 }
 
-T_Expr parse_term(const std::vector<T_Token>& Tokens, int& Current)
+// Profiling
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Batch mode
+//
+// Every line of stdin is a record. Input is read in large blocks and each
+// record is parsed where it lies; only a record cut off by the end of a block
+// is moved, once, to the front. The context's arenas are reset by each parse,
+// so records run without allocating. Each record produces exactly one line of
+// output, its values joined by "; " and then its first error if any, so
+// output line N belongs to input line N. That holds for a record nested too
+// deeply to walk safely as well: the parser rejects it with a diagnostic, so
+// one bad record cannot take the batch down.
+//
+// Unless the memo limit is 0, a record seen before is answered from the memo
+// cache without parsing, and a statement of a known shape without evaluating.
+
+static constexpr uint32_t BATCH_READ_SIZE  = 1024 * 1024;
+static constexpr uint32_t BATCH_WRITE_SIZE = 1024 * 1024;
+
+struct T_BatchOutput
 {
-   T_Expr expr = {};
+   std::vector<char> Data;
+   uint32_t          Used;
+   uint32_t          Flushes;
+};
 
-   expr = parse_factor(Tokens, Current);
+static void flush_batch(T_BatchOutput& Output)
+{
+   uint32_t written = 0;
 
-   while (Tokens[Current].Type == MINUS ||
-          Tokens[Current].Type == PLUS)
+   while (written < Output.Used)
    {
-      T_BinaryExpr* binary = new T_BinaryExpr;
+      ssize_t count = write(STDOUT_FILENO, Output.Data.data() + written, Output.Used - written);
 
-      binary->Operator = Tokens[Current++];
-      binary->Left     = expr;
-      binary->Right    = parse_factor(Tokens, Current);
+      if (count < 0 && errno == EINTR)
+         continue;
 
-      expr.Type = ExprTypes::Binary;
-      expr.Expr = binary;
+      if (count <= 0)
+      {
+         fprintf(stderr, "ERROR: Unable to write output.\n");
+         exit(74);
+      }
+
+      written += count;
    }
 
-   return expr;
+   Output.Used = 0;
+   Output.Flushes++;
 }
 
-T_Expr parse_comparison(const std::vector<T_Token>& Tokens, int& Current)
+// Makes room for Size more bytes
+static char* reserve_batch(T_BatchOutput& Output, uint32_t Size)
 {
-   T_Expr expr = {};
+   if (Output.Used + Size > Output.Data.size())
+   {
+      flush_batch(Output);
 
-   expr = parse_term(Tokens, Current);
+      if (Size > Output.Data.size())
+         Output.Data.resize(Size);
+   }
 
-   while (Tokens[Current].Type == GREATER ||
-          Tokens[Current].Type == GREATER_EQUAL ||
-          Tokens[Current].Type == LESS ||
-          Tokens[Current].Type == LESS_EQUAL)
-   {
-      T_BinaryExpr* binary = new T_BinaryExpr;
+   return Output.Data.data() + Output.Used;
+}
+
+static void write_batch(T_BatchOutput& Output, const char* Text, uint32_t Length)
+{
+   memcpy(reserve_batch(Output, Length), Text, Length);
+   Output.Used += Length;
+}
 
-      binary->Operator = Tokens[Current++];
-      binary->Left     = expr;
-      binary->Right    = parse_unary(Tokens, Current);
+static void write_batch_value(T_BatchOutput& Output, T_Value Value)
+{
+   uint32_t available = Output.Data.size() - Output.Used;
+   uint32_t length    = format_value(Output.Data.data() + Output.Used, available, Value);
 
-      expr.Type = ExprTypes::Binary;
-      expr.Expr = binary;
-   }
+   // format_value wants room for its terminator too
+   if (length >= available)
+      length = format_value(reserve_batch(Output, length + 1), length + 1, Value);
 
-   return expr;
+   Output.Used += length;
 }
 
-T_Expr parse_equality(const std::vector<T_Token>& Tokens, int& Current)
+static void run_record(T_LoxContext& Context, T_BatchOutput& Output, T_MemoCache* Memo, char* Record, uint32_t Length)
 {
-   T_Expr expr = {};
+   if (Length && Record[Length - 1] == '\r')
+      Length--;
 
-   expr = parse_comparison(Tokens, Current);
+   if (Memo && !memo_awake(*Memo))
+      Memo = nullptr;
 
-   while (Tokens[Current].Type == BANG_EQUAL ||
-          Tokens[Current].Type == EQUAL_EQUAL)
+   if (Memo)
    {
-      T_BinaryExpr* binary = new T_BinaryExpr;
+      const T_MemoEntry* entry = memo_find_record(*Memo, Record, Length);
+
+      if (entry)
+      {
+         write_batch(Output, entry->Result.data(), entry->Result.size());
+         write_batch(Output, "\n", 1);
+         return;
+      }
+   }
 
-      binary->Operator = Tokens[Current++];
-      binary->Left     = expr;
-      binary->Right    = parse_comparison(Tokens, Current);
+   uint32_t start   = Output.Used;
+   uint32_t flushes = Output.Flushes;
+   uint32_t values  = 0;
 
-      expr.Type = ExprTypes::Binary;
-      expr.Expr = binary;
+   if (lox_parse(Context, Record, Length))
+   {
+      for (const auto& statement : Context.Statements)
+      {
+         const T_MemoEntry* entry = nullptr;
+         T_Value            value;
+
+         if (Memo)
+            entry = memo_evaluate(*Memo, Context, statement);
+         else
+            value = evaluate(Context, statement);
+
+         if (!Context.Diagnostics.empty())
+            break;
+
+         if (values++)
+            write_batch(Output, "; ", 2);
+
+         if (entry)
+            write_batch(Output, entry->Result.data(), entry->Result.size());
+         else
+            write_batch_value(Output, value);
+      }
    }
 
-   return expr;
-}
+   if (!Context.Diagnostics.empty())
+   {
+      const char* message = Context.Diagnostics[0].Message;
 
-T_Expr parse_expression(const std::vector<T_Token>& Tokens, int& Current)
-{
-   return parse_equality(Tokens, Current);
+      // values of the statements before a runtime error stay in front
+      if (values)
+         write_batch(Output, "; ", 2);
+
+      write_batch(Output, "Error: ", 7);
+      write_batch(Output, message, strlen(message));
+   }
+
+   // a line that straddles a flush is simply not remembered
+   if (Memo && Output.Flushes == flushes)
+      memo_store_record(*Memo, Record, Length, Output.Data.data() + start, Output.Used - start);
+
+   write_batch(Output, "\n", 1);
 }
 
-T_Expr parse_tokens(const std::vector<T_Token>& Tokens)
+void run_batch(uint64_t MemoLimit, bool Stats)
 {
-   int current = 0;
-   return parse_expression(Tokens, current);
-}
+   T_LoxContext      context;
+   T_MemoCache       memo;
+   T_BatchOutput     output = { std::vector<char>(BATCH_WRITE_SIZE), 0, 0 };
+   std::vector<char> input(BATCH_READ_SIZE);
+   uint32_t          filled = 0;
+   T_MemoCache*      cache  = MemoLimit ? &memo : nullptr;
 
-// Parsing functions
-///////////////////////////////////////////////////////////////////////////////
+   memo.Limit = MemoLimit;
 
-void print_ast(T_Expr Expr)
-{
-   if (!Expr.Expr)
-      return;
+   // records are far too small to be worth splitting across threads
+   context.ParseThreads = 1;
 
-   printf("(");
-   switch(Expr.Type)
+   while (1)
    {
-      case ExprTypes::Binary:
-      {
-         T_BinaryExpr* binary = (T_BinaryExpr*)Expr.Expr;
-         printf("%.*s", binary->Operator.Length, binary->Operator.Lexeme);
-         print_ast(binary->Left);
-         print_ast(binary->Right);
-         break;
-      }
-      case ExprTypes::Grouping:
+      ssize_t count = read(STDIN_FILENO, input.data() + filled, input.size() - filled);
+
+      if (count < 0 && errno == EINTR)
+         continue;
+
+      if (count < 0)
       {
-         T_GroupingExpr* grouping = (T_GroupingExpr*)Expr.Expr;
-         printf("group");
-         print_ast(grouping->Expression);
-         break;
+         fprintf(stderr, "ERROR: Unable to read input.\n");
+         exit(74);
       }
-      case ExprTypes::Literal:
+
+      char* begin = input.data();
+      char* end   = begin + filled + count;
+      char* newline;
+
+      while ((newline = (char*)memchr(begin, '\n', end - begin)))
       {
-         T_LiteralExpr* literal = (T_LiteralExpr*)Expr.Expr;
-         printf("%.*s", literal->Value.Length, literal->Value.Lexeme);
-         break;
+         run_record(context, output, cache, begin, newline - begin);
+         begin = newline + 1;
       }
-      case ExprTypes::Unary:
+
+      if (count == 0)
       {
-         T_UnaryExpr* unary = (T_UnaryExpr*)Expr.Expr;
-         printf("%.*s", unary->Operator.Length, unary->Operator.Lexeme);
-         print_ast(unary->Right);
+         if (begin < end)
+            run_record(context, output, cache, begin, end - begin);
+
          break;
       }
-      case ExprTypes::Error:
-      {
-         T_ErrorExpr* error = (T_ErrorExpr*)Expr.Expr;
-         printf("\nERROR: %s at line %d\n", error->Error.Lexeme, error->Error.Line);
-         return;
-      }
-   }
-   printf(")");
-}
 
-void run(char* String, uint32_t Size)
-{
-   std::vector<T_Token> tokens;
-
-   printf("Scanning\n");
-   scan_tokens(String, Size, tokens);
+      // carry the unfinished record over to the next block
+      filled = end - begin;
+      memmove(input.data(), begin, filled);
 
-   printf("Tokens %ld\n", tokens.size());
-   for (const auto& token : tokens)
-   {
-      printf("Type %s (%d): %.*s\n", TokenTypeStr[token.Type], token.Type, token.Length, token.Lexeme);
+      if (filled == input.size())
+         input.resize(input.size() * 2);
    }
 
-   printf("\nParsing\n");
-   T_Expr expr = parse_tokens(tokens);
+   flush_batch(output);
 
-   if (had_error)
-      return;
-
-   // print AST tree
-   print_ast(expr);
-   printf("\n");
+   if (Stats)
+      write_memo_stats(stderr, memo);
 }
 
+// Batch mode
+///////////////////////////////////////////////////////////////////////////////
+
 void run_file(const char* Filename)
 {
-   TBuffer buffer = ReadEntireFile(Filename);
+   TBuffer      buffer = ReadEntireFile(Filename);
+   T_LoxContext context;
+
+   // a script file can be large enough to be worth parsing on every core
+   context.ParseThreads = 0;
 
    if (buffer.Data && buffer.Count)
    {
-      run((char*)buffer.Data, buffer.Count);
+      bool ok = run(context, nullptr, (char*)buffer.Data, buffer.Count);
       delete [] buffer.Data;
 
-      if (had_error) exit(65);
+      if (!ok) exit(65);
    }
 }
 
-void run_prompt()
+// Lines repeat a lot at a prompt, so results are memoized unless MemoLimit
+// is 0. 'stats' prints the memo cache statistics.
+void run_prompt(uint64_t MemoLimit)
 {
-   TBuffer buffer;
+   TBuffer      buffer;
+   T_LoxContext context;
+   T_MemoCache  memo;
+   T_MemoCache* cache = MemoLimit ? &memo : nullptr;
+
+   memo.Limit = MemoLimit;
 
    buffer.Data = new uint8_t[4096];
    buffer.Count = 0;
@@ -606,11 +466,15 @@ void run_prompt()
 
       buffer.Data = (uint8_t*) fgets((char*)buffer.Data, 4096, stdin);
 
-      if (buffer.Data && strncasecmp((char*)buffer.Data, "quit", strlen("quit")) != 0)
+      // only the whole line: 'stats + 1' is an expression
+      if (buffer.Data && strcasecmp((char*)buffer.Data, "stats\n") == 0)
+      {
+         write_memo_stats(stdout, memo);
+      }
+      else if (buffer.Data && strncasecmp((char*)buffer.Data, "quit", strlen("quit")) != 0)
       {
          buffer.Count = strlen((char*)buffer.Data);
-         run((char*)buffer.Data, buffer.Count);
-         had_error = false;
+         run(context, cache, (char*)buffer.Data, buffer.Count);
       }
       else
       {
@@ -621,26 +485,60 @@ void run_prompt()
 
 int main(int argc, char* argv[])
 {
-   keywords["and"] = AND;
-   keywords["class"] = CLASS;
-   keywords["else"] = ELSE;
-   keywords["false"] = FALSE;
-   keywords["for"] = FOR;
-   keywords["fun"] = FUN;
-   keywords["if"] = IF;
-   keywords["nil"] = NIL;
-   keywords["or"] = OR;
-   keywords["print"] = PRINT;
-   keywords["return"] = RETURN;
-   keywords["super"] = SUPER;
-   keywords["this"] = THIS;
-   keywords["true"] = TRUE;
-   keywords["var"] = VAR;
-   keywords["while"] = WHILE;
-
-   if (argc > 2)
+   if (argc >= 4 && argc <= 5 && strcmp(argv[1], "--columns") == 0)
+   {
+      run_columns(argv[2], argv[3], argc == 5 ? argv[4] : nullptr);
+      return 0;
+   }
+   else if (argc == 3 && strcmp(argv[1], "--serve") == 0)
+   {
+      return run_server(argv[2]);
+   }
+   else if (argc >= 2 && strcmp(argv[1], "--batch") == 0)
+   {
+      uint64_t limit = MEMO_DEFAULT_LIMIT;
+      bool     stats = false;
+
+      for (int i = 2; i < argc; i++)
+      {
+         if (strncmp(argv[i], "--memo=", 7) == 0)
+         {
+            limit = strtoull(argv[i] + 7, nullptr, 10) * 1024 * 1024;
+         }
+         else if (strcmp(argv[i], "--stats") == 0)
+         {
+            stats = true;
+         }
+         else
+         {
+            fprintf(stderr, "ERROR: Unknown batch option \"%s\".\n", argv[i]);
+            return 1;
+         }
+      }
+
+      run_batch(limit, stats);
+      return 0;
+   }
+   else if (argc >= 3 && argc <= 4 && strncmp(argv[1], "--profile", 9) == 0 &&
+            (argv[1][9] == 0 || argv[1][9] == '='))
+   {
+      uint32_t period = argv[1][9] == '=' ? strtoul(argv[1] + 10, nullptr, 10) : 1;
+
+      run_profile(argv[2], period, argc == 4 ? argv[3] : nullptr);
+      return 0;
+   }
+   else if (argc == 2 && strncmp(argv[1], "--memo=", 7) == 0)
+   {
+      run_prompt(strtoull(argv[1] + 7, nullptr, 10) * 1024 * 1024);
+   }
+   else if (argc > 2)
    {
       printf("Usage: jlox [script]\n");
+      printf("       jlox --memo=<MB, 0 disables>\n");
+      printf("       jlox --columns <script> <input.csv|input.bin> [output]\n");
+      printf("       jlox --serve <socket>\n");
+      printf("       jlox --batch [--memo=<MB, 0 disables>] [--stats] < records\n");
+      printf("       jlox --profile[=<sample period>] <script> [folded stacks]\n");
       return 1;
    }
    else if (argc == 2)
@@ -649,7 +547,7 @@ int main(int argc, char* argv[])
    }
    else
    {
-      run_prompt();
+      run_prompt(MEMO_DEFAULT_LIMIT);
    }
 
    return 1;
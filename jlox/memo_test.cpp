@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include "Memo.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Memo LRU stress test
+//
+// Drives the record cache with random lookups and stores under a small byte
+// limit, so entries are evicted and their slots removed all the time, and
+// checks it against a reference model after every step. The model keeps
+// every key ever stored in recency order; the cache must hold exactly its
+// newest Count keys, in that order, with the results last stored for them.
+// Eviction sizes depend on string capacities, so the model takes Count from
+// the cache and checks the limit instead.
+//
+// The slot table is checked too: every entry must be reachable from its home
+// slot without crossing an empty one, which backward shift deletion has to
+// keep true without tombstones.
+
+static constexpr uint32_t TEST_STEPS      = 60000;
+static constexpr uint32_t TEST_KEYS       = 3000;
+static constexpr uint64_t TEST_LIMIT      = 96 * 1024;
+static constexpr uint32_t TEST_MAX_RESULT = 1500;
+
+struct T_Model
+{
+   std::list<std::string>                                           Recency; // newest first
+   std::unordered_map<std::string, std::list<std::string>::iterator> Where;
+   std::unordered_map<std::string, std::string>                     Results;
+};
+
+static std::string make_key(uint32_t Index)
+{
+   // lengths vary so reused entries keep buffers of other sizes
+   return "k" + std::to_string(Index) + std::string(Index % 61, 'x');
+}
+
+static std::string make_result(uint32_t Step)
+{
+   uint32_t length = rand() % TEST_MAX_RESULT;
+
+   return std::string(length, (char)('a' + Step % 26));
+}
+
+static void touch(T_Model& Model, const std::string& Key)
+{
+   auto where = Model.Where.find(Key);
+
+   if (where != Model.Where.end())
+      Model.Recency.erase(where->second);
+
+   Model.Recency.push_front(Key);
+   Model.Where[Key] = Model.Recency.begin();
+}
+
+// Whether Key is among the model's newest Count keys
+static bool is_newest(const T_Model& Model, const std::string& Key, uint32_t Count)
+{
+   auto key = Model.Recency.begin();
+
+   for (uint32_t i = 0; i < Count && key != Model.Recency.end(); i++, ++key)
+   {
+      if (*key == Key)
+         return true;
+   }
+
+   return false;
+}
+
+static const char* check_cache(const T_MemoCache& Cache, const T_Model& Model)
+{
+   // the LRU list is the model's newest Count keys
+   auto     expected = Model.Recency.begin();
+   uint32_t count    = 0;
+   uint64_t bytes    = 0;
+   uint32_t newer    = MEMO_NONE;
+
+   for (uint32_t index = Cache.Newest; index != MEMO_NONE; index = Cache.Entries[index].Older)
+   {
+      const T_MemoEntry& entry = Cache.Entries[index];
+
+      if (expected == Model.Recency.end() || entry.Key != *expected)
+         return "LRU order differs from the model";
+
+      if (entry.Result != Model.Results.at(entry.Key))
+         return "entry holds a stale result";
+
+      if (entry.Newer != newer)
+         return "broken Newer link";
+
+      newer  = index;
+      bytes += entry.Charged;
+      count++;
+      ++expected;
+   }
+
+   if (newer != Cache.Oldest)
+      return "Oldest is not the end of the list";
+
+   if (count != Cache.Count)
+      return "Count differs from the list length";
+
+   if (bytes != Cache.Bytes)
+      return "Bytes differs from the charged total";
+
+   if (Cache.Bytes > Cache.Limit)
+      return "over the limit";
+
+   // every entry is in exactly one slot, reachable from its home
+   uint32_t mask  = Cache.Slots.size() - 1;
+   uint32_t slots = 0;
+
+   for (uint32_t i = 0; i < Cache.Slots.size(); i++)
+   {
+      const T_MemoSlot& slot = Cache.Slots[i];
+
+      if (slot.Entry == MEMO_NONE)
+         continue;
+
+      slots++;
+
+      if (slot.Hash != Cache.Entries[slot.Entry].Hash)
+         return "slot hash differs from its entry";
+
+      for (uint32_t j = slot.Hash & mask; j != i; j = (j + 1) & mask)
+      {
+         if (Cache.Slots[j].Entry == MEMO_NONE)
+            return "entry cut off from its home slot";
+      }
+   }
+
+   if (slots != Cache.Count)
+      return "slot count differs from Count";
+
+   return nullptr;
+}
+
+int main()
+{
+   T_MemoCache cache;
+   T_Model     model;
+   uint32_t    failures = 0;
+   uint64_t    hits     = 0;
+
+   cache.Limit = TEST_LIMIT;
+   srand(1);
+
+   for (uint32_t step = 0; step < TEST_STEPS && !failures; step++)
+   {
+      // a skewed choice keeps some keys hot and lets others age out
+      uint32_t    index   = rand() % 4 ? rand() % (TEST_KEYS / 20) : rand() % TEST_KEYS;
+      std::string key     = make_key(index);
+      bool        present = is_newest(model, key, cache.Count);
+
+      const T_MemoEntry* found = memo_find_record(cache, key.data(), key.size());
+
+      if ((found != nullptr) != present)
+      {
+         printf("FAIL: step %u key %s %s\n", step, key.c_str(), present ? "missing" : "found after eviction");
+         failures++;
+         break;
+      }
+
+      if (found)
+      {
+         if (found->Result != model.Results[key])
+         {
+            printf("FAIL: step %u key %s returned a stale result\n", step, key.c_str());
+            failures++;
+            break;
+         }
+
+         hits++;
+         touch(model, key);
+      }
+      else
+      {
+         std::string result = make_result(step);
+
+         memo_store_record(cache, key.data(), key.size(), result.data(), result.size());
+         model.Results[key] = result;
+         touch(model, key);
+      }
+
+      const char* error = check_cache(cache, model);
+
+      if (error)
+      {
+         printf("FAIL: step %u: %s\n", step, error);
+         failures++;
+         break;
+      }
+   }
+
+   printf("memo: %u steps, %lu hits, %lu evictions, %u failures\n", TEST_STEPS, (unsigned long)hits,
+          (unsigned long)cache.Stats.Evictions, failures);
+
+   return failures ? 1 : 0;
+}
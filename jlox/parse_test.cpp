@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "Lox.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Parallel parse test
+//
+// Parses random scripts on one thread and on several and requires the same
+// AST dump, byte for byte, and the same diagnostics in the same order. The
+// scripts are large enough to be split into shards and mix valid statements
+// with parse errors, type errors and over-deep nesting, so the merge of
+// shard diagnostics back into statement order is exercised as well as the
+// statements themselves. Parentheses stay balanced, as an unclosed one would
+// make the rest of the script a single statement. The threaded context is
+// reused across scripts, as its pool is.
+
+static constexpr uint32_t TEST_SCRIPTS    = 24;
+static constexpr uint32_t TEST_STATEMENTS = 3000;
+static constexpr uint32_t TEST_THREADS    = 4;
+
+static void random_expr(std::string& Out, uint32_t Depth)
+{
+   static const char* const Operators[] = { " + ", " - ", " * ", " / ", " == ", " != ", " < ", " <= ", " > ", " >= " };
+   static const char* const Operands[]  = { "1", "2.5", "\"a\"", "\"bc\"", "true", "false", "nil", "x", "y" };
+
+   uint32_t choice = Depth < 6 ? rand() % 8 : 0;
+
+   switch (choice)
+   {
+      case 0:
+      case 1:
+      case 2:
+         Out += Operands[rand() % (sizeof(Operands) / sizeof(Operands[0]))];
+         break;
+      case 3:
+         Out += rand() % 2 ? "-" : "!";
+         random_expr(Out, Depth + 1);
+         break;
+      case 4:
+         Out += "(";
+         random_expr(Out, Depth + 1);
+         Out += ")";
+         break;
+      default:
+         random_expr(Out, Depth + 1);
+         Out += Operators[rand() % (sizeof(Operators) / sizeof(Operators[0]))];
+         random_expr(Out, Depth + 1);
+         break;
+   }
+}
+
+static std::string random_script()
+{
+   std::string script;
+
+   for (uint32_t i = 0; i < TEST_STATEMENTS; i++)
+   {
+      switch (rand() % 40)
+      {
+         case 0:  script += "(1 + );";                         break; // missing operand
+         case 1:  script += "(1 2);";                          break; // missing ')'
+         case 2:  script += "1 2;";                            break; // missing ';'
+         case 3:  script += "@;";                              break; // scanner error
+         case 4:  script += std::string(300, '(') + "1" + std::string(300, ')') + ";"; break; // too deeply nested
+         case 5:  script += std::string(300, '-') + "1;";      break;
+         default: random_expr(script, 0); script += ";";       break;
+      }
+
+      // lines vary so diagnostics carry different lines
+      script += rand() % 3 ? " " : "\n";
+   }
+
+   return script;
+}
+
+static std::string dump(const T_LoxContext& Context)
+{
+   std::string text;
+
+   for (const auto& diagnostic : Context.Diagnostics)
+      text += std::string(diagnostic.Message) + " at " + std::to_string(diagnostic.Line) + "\n";
+
+   uint32_t length = format_statements(nullptr, 0, Context);
+   uint32_t start  = text.size();
+
+   text.resize(start + length + 1);
+   format_statements(&text[start], length + 1, Context);
+   text.resize(start + length);
+
+   return text;
+}
+
+int main()
+{
+   T_LoxContext serial;
+   T_LoxContext parallel;
+   uint32_t     failures = 0;
+   uint64_t     diagnostics = 0;
+
+   serial.ParseThreads   = 1;
+   parallel.ParseThreads = TEST_THREADS;
+   srand(1);
+
+   for (uint32_t n = 0; n < TEST_SCRIPTS; n++)
+   {
+      std::string script = random_script();
+
+      lox_parse(serial, &script[0], script.size());
+      lox_parse(parallel, &script[0], script.size());
+
+      // a script too small to split would compare nothing
+      if (parallel.ParseWorkers.WorkerCount() != TEST_THREADS)
+      {
+         printf("FAIL: script %u was parsed on one thread\n", n);
+         failures++;
+         continue;
+      }
+
+      std::string expected = dump(serial);
+      std::string actual   = dump(parallel);
+
+      diagnostics += serial.Diagnostics.size();
+
+      if (expected != actual && failures++ < 10)
+      {
+         uint32_t at = 0;
+
+         while (at < expected.size() && at < actual.size() && expected[at] == actual[at])
+            at++;
+
+         printf("FAIL: script %u differs at byte %u: \"%.40s\" vs \"%.40s\"\n", n, at,
+                expected.c_str() + at, actual.c_str() + at);
+      }
+   }
+
+   printf("parse: %u scripts on 1 and %u threads, %lu diagnostics, %u failures\n", TEST_SCRIPTS, TEST_THREADS,
+          (unsigned long)diagnostics, failures);
+
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "Lox.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Scanner differential test
+//
+// Runs the table-driven scan_tokens against the switch scanner it replaced
+// on random inputs and requires the same tokens and diagnostics. The old
+// scanner had two bugs the new one intentionally does not reproduce, so
+// these are the expected differences:
+//
+//    1. A '//' comment compared its index rather than its character with
+//       '\n', so it ran to index 10 or the end of the input instead of the
+//       end of its line. Tokens from the first comment on are not compared.
+//    2. Strings made the same mistake counting lines: a newline inside one
+//       was missed and index 10 inside one counted. Lines are not compared
+//       for inputs where a string hits either.
+
+static constexpr uint32_t TEST_INPUTS     = 20000;
+static constexpr uint32_t TEST_MAX_PIECES = 40;
+
+struct T_Reference
+{
+   std::vector<T_Token>     Tokens;
+   std::vector<std::string> Errors;
+   const char*              CommentAt;     // first '//' comment, or nullptr
+   bool                     StringLines;   // a string miscounted lines
+};
+
+static const std::unordered_map<std::string, TokenType> Keywords =
+{
+   { "and", AND }, { "class", CLASS }, { "else", ELSE }, { "false", FALSE },
+   { "fun", FUN }, { "for", FOR }, { "if", IF }, { "nil", NIL }, { "or", OR },
+   { "print", PRINT }, { "return", RETURN }, { "super", SUPER }, { "this", THIS },
+   { "true", TRUE }, { "var", VAR }, { "while", WHILE },
+};
+
+// The switch scanner as it was before the lexer tables, with its output
+// captured instead of printed. String must be NUL-terminated.
+static void reference_scan(char* String, uint32_t Size, T_Reference& Result)
+{
+   std::vector<T_Token>& Tokens = Result.Tokens;
+   uint32_t              start = 0;
+   uint32_t              current = 0;
+   uint32_t              line = 1;
+
+   Result.CommentAt     = nullptr;
+   Result.StringLines   = false;
+
+   while (current < Size)
+   {
+      switch (String[current])
+      {
+         case '(': Tokens.push_back({ TokenType::LEFT_PAREN, &String[current], 1, line }); break;
+         case ')': Tokens.push_back({ TokenType::RIGHT_PAREN, &String[current], 1, line }); break;
+         case '{': Tokens.push_back({ TokenType::LEFT_BRACE, &String[current], 1, line }); break;
+         case '}': Tokens.push_back({ TokenType::RIGHT_BRACE, &String[current], 1, line }); break;
+         case ',': Tokens.push_back({ TokenType::COMMA, &String[current], 1, line }); break;
+         case '.': Tokens.push_back({ TokenType::DOT, &String[current], 1, line }); break;
+         case '-': Tokens.push_back({ TokenType::MINUS, &String[current], 1, line }); break;
+         case '+': Tokens.push_back({ TokenType::PLUS, &String[current], 1, line }); break;
+         case ';': Tokens.push_back({ TokenType::SEMICOLON, &String[current], 1, line }); break;
+         case '*': Tokens.push_back({ TokenType::STAR, &String[current], 1, line }); break;
+         case '!':
+         case '=':
+         case '<':
+         case '>':
+         {
+            static const TokenType single[] = { BANG, EQUAL, LESS, GREATER };
+            static const TokenType pair[]   = { BANG_EQUAL, EQUAL_EQUAL, LESS_EQUAL, GREATER_EQUAL };
+            uint32_t               which    = strchr("!=<>", String[current]) - "!=<>";
+
+            if (String[current+1] == '=')
+            {
+               Tokens.push_back({ pair[which], &String[current], 2, line });
+               current++;
+            }
+            else
+            {
+               Tokens.push_back({ single[which], &String[current], 1, line });
+            }
+            break;
+         }
+         case '/':
+            if (String[current+1] == '/')
+            {
+               // expected difference 1: the index is compared with '\n'
+               if (!Result.CommentAt)
+                  Result.CommentAt = &String[current];
+
+               while (current != '\n' && current < Size)
+                  current++;
+            }
+            else
+            {
+               Tokens.push_back({ TokenType::SLASH, &String[current], 1, line });
+            }
+            break;
+         case '"':
+            current++;
+            start = current;
+            while (String[current] != '"' && current < Size)
+            {
+               // expected difference 2: the index is compared with '\n'
+               if (current == '\n')
+                  line++;
+
+               Result.StringLines |= current == '\n' || String[current] == '\n';
+               current++;
+            }
+
+            if (current == Size)
+               Result.Errors.push_back("Unterminated string");
+            else
+               Tokens.push_back({ TokenType::STRING, &String[start], current - start, line });
+            break;
+         case ' ':
+         case '\t':
+         case '\r':
+            break;
+         case '\n':
+            line++;
+            break;
+         default:
+            if (isdigit(String[current]))
+            {
+               start = current++;
+               while ((isdigit(String[current]) || (String[current] == '.' && isdigit(String[current+1]))) && current < Size)
+                  current++;
+
+               Tokens.push_back({ TokenType::NUMBER, &String[start], current - start, line });
+               current--;
+            }
+            else if (isalpha(String[current]))
+            {
+               start = current++;
+               while (isalnum(String[current]) && current < Size)
+                  current++;
+
+               auto      keyword = Keywords.find(std::string(&String[start], current - start));
+               TokenType type    = keyword != Keywords.end() ? keyword->second : TokenType::IDENTIFIER;
+
+               Tokens.push_back({ type, &String[start], current - start, line });
+               current--;
+            }
+            else
+            {
+               Result.Errors.push_back("Unexpected character");
+            }
+      }
+
+      current++;
+   }
+
+   Tokens.push_back({ TokenType::END_OF_FILE, nullptr, 0, line });
+}
+
+static std::string random_input()
+{
+   static const char* const Pieces[] =
+   {
+      "(", ")", "{", "}", ",", ".", "-", "+", ";", "*", "/", "!", "!=", "=", "==",
+      "<", "<=", ">", ">=", " ", "  ", "\t", "\r", "\n", "1", "42", "3.14", "7.",
+      ".5", "\"str\"", "\"a b\"", "\"line\nbreak\"", "\"", "x", "foo", "a1", "and",
+      "class", "else", "false", "for", "fun", "if", "nil", "or", "print", "return",
+      "super", "this", "true", "var", "while", "orchid", "//", "// note\n", "@", "#",
+   };
+
+   std::string input;
+   uint32_t    pieces = rand() % TEST_MAX_PIECES;
+
+   for (uint32_t i = 0; i < pieces; i++)
+      input += Pieces[rand() % (sizeof(Pieces) / sizeof(Pieces[0]))];
+
+   return input;
+}
+
+static bool same_token(const T_Token& A, const T_Token& B, bool CompareLines)
+{
+   return A.Type == B.Type && A.Length == B.Length && A.Lexeme == B.Lexeme &&
+          (!CompareLines || A.Line == B.Line);
+}
+
+int main()
+{
+   T_LoxContext context;
+   uint32_t     failures = 0;
+
+   srand(1);
+
+   for (uint32_t n = 0; n < TEST_INPUTS; n++)
+   {
+      std::string input = random_input();
+      T_Reference reference;
+
+      reference_scan(&input[0], input.size(), reference);
+
+      context.Tokens.clear();
+      context.Diagnostics.clear();
+      scan_tokens(context, &input[0], input.size());
+
+      std::vector<T_Token> tokens = context.Tokens;
+      bool                 lines  = !reference.StringLines;
+
+      // everything after the first comment is only scanned by the new scanner
+      if (reference.CommentAt)
+      {
+         auto after = [&](const T_Token& Token) { return Token.Lexeme && Token.Lexeme >= reference.CommentAt; };
+
+         tokens.erase(std::remove_if(tokens.begin(), tokens.end(), after), tokens.end());
+         reference.Tokens.erase(std::remove_if(reference.Tokens.begin(), reference.Tokens.end(), after), reference.Tokens.end());
+         lines = false;
+      }
+
+      bool same = tokens.size() == reference.Tokens.size();
+
+      for (uint32_t i = 0; same && i < tokens.size(); i++)
+         same = same_token(tokens[i], reference.Tokens[i], lines);
+
+      // diagnostics carry no position to cut them at the comment with
+      if (same && !reference.CommentAt)
+      {
+         same = context.Diagnostics.size() == reference.Errors.size();
+
+         for (uint32_t i = 0; same && i < reference.Errors.size(); i++)
+            same = reference.Errors[i] == context.Diagnostics[i].Message;
+      }
+
+      if (!same && failures++ < 10)
+         printf("FAIL: %s\n", input.c_str());
+   }
+
+   printf("scanner: %u inputs, %u failures\n", TEST_INPUTS, failures);
+
+   return failures ? 1 : 0;
+}